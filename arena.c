@@ -0,0 +1,180 @@
+// arena.c
+//
+// Bump allocator: storage comes from a list of large blocks and is only ever
+// released all at once by resetArena() or freeArena().  The Arena struct lives
+// at the start of its own first block, so creating an arena costs one malloc.
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+#include "stats.h"
+
+#define ARENA_BLOCK  4096               // Size of first block in bytes
+#define ARENA_MAX    (1 << 20)          // Largest block grown automatically
+
+// Union of the types whose alignment arenaAlloc() must respect
+typedef union align {
+    long long l;
+    long double d;
+    void *p;
+    void (*f)(void);
+} Align;
+
+#define ROUND(n) (((n) + sizeof(Align) - 1) / sizeof(Align) * sizeof(Align))
+
+typedef struct block {
+    struct block *next;                 // Next (older) block or NULL
+    size_t size;                        // #bytes available in data[]
+    size_t used;                        // #bytes of data[] handed out
+    Align data[];                       // Storage
+} Block;
+
+typedef struct deferred {
+    struct deferred *next;              // Next (older) call or NULL
+    void (*fn) (void *);                // Function to call with the arena
+    void *p;                            //   on this argument
+} Deferred;
+
+struct arena {
+    Block *head;                        // Block that allocations come from
+    Block *first;                       // Block holding this struct
+    Deferred *deferred;                 // Calls to make when released
+    int refs;                           // #references (see arenaRetain())
+};
+
+
+// Allocate and return a block with SIZE bytes of storage
+static Block *mallocBlock (size_t size)
+{
+    Block *b = malloc (sizeof(*b) + size);
+    STATS_ALLOC (sizeof(*b) + size);
+    if (!b)
+        abort();
+    b->next = NULL;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+
+Arena *mallocArena (void)
+{
+    Block *b = mallocBlock (ARENA_BLOCK);
+    Arena *a = (Arena *) b->data;
+
+    b->used  = ROUND (sizeof(*a));
+    a->head  = b;
+    a->first = b;
+    a->deferred = NULL;
+    a->refs  = 1;
+    return a;
+}
+
+
+void *arenaAlloc (Arena *a, size_t n)
+{
+    Block *b = a->head;
+    n = ROUND (n ? n : 1);
+    STATS_ARENA (n);
+
+    if (b->size - b->used < n) {
+        if (n > b->size / 4) {                  // Large request gets its own
+            Block *big = mallocBlock (n);       //   block, linked behind the
+            big->used = n;                      //   current one so that the
+            big->next = b->next;                //   rest of it is not wasted
+            b->next = big;
+            return big->data;
+        }
+        size_t size = b->size * 2;              // Otherwise grow geometrically
+        if (size > ARENA_MAX)
+            size = ARENA_MAX;
+        b = mallocBlock (size);
+        b->next = a->head;
+        a->head = b;
+    }
+
+    void *p = (char *) b->data + b->used;
+    b->used += n;
+    return p;
+}
+
+
+char *arenaStrndup (Arena *a, const char *s, size_t n)
+{
+    char *t = arenaAlloc (a, n+1);
+    memcpy (t, s, n);
+    t[n] = '\0';
+    return t;
+}
+
+
+void *arenaDefer (Arena *a, void (*fn) (void *), void *p)
+{
+    Deferred *new = arenaAlloc (a, sizeof(*new));
+
+    new->fn = fn;
+    new->p = p;
+    new->next = a->deferred;
+    a->deferred = new;
+    return p;
+}
+
+
+void *arenaAdopt (Arena *a, void *p)
+{
+    return arenaDefer (a, free, p);
+}
+
+
+// Make the calls deferred by A, then free every block in the list starting
+// at B except the first block of A
+static void freeBlocks (Arena *a, Block *b)
+{
+    for (Deferred *q = a->deferred;  q;  q = q->next)
+        q->fn (q->p);
+    a->deferred = NULL;
+
+    while (b) {
+        Block *next = b->next;
+        if (b != a->first)
+            free (b);
+        b = next;
+    }
+}
+
+
+void resetArena (Arena *a)
+{
+    freeBlocks (a, a->head);
+    a->first->next = NULL;
+    a->first->used = ROUND (sizeof(*a));
+    a->head = a->first;
+}
+
+
+Arena *arenaRetain (Arena *a)
+{
+    a->refs++;
+    return a;
+}
+
+
+size_t arenaSize (Arena *a)
+{
+    size_t size = 0;
+    for (Block *b = a->head;  b;  b = b->next)
+        size += sizeof(*b) + b->size;
+    return size;
+}
+
+
+Arena *freeArena (Arena *a)
+{
+    if (!a || --a->refs > 0)
+        return NULL;
+
+    Block *first = a->first;
+    freeBlocks (a, a->head);
+    free (first);
+    return NULL;
+}
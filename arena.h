@@ -0,0 +1,57 @@
+// arena.h
+//
+// Header file for the bump allocator used by parse().  Every token, string,
+// and CMD struct for one command line comes from a single arena, so that the
+// whole tree can be released at once instead of node by node.
+
+#ifndef ARENA_INCLUDED
+#define ARENA_INCLUDED          // arena.h has been #include-d
+
+#include <stddef.h>
+
+typedef struct arena Arena;
+
+
+// Allocate, initialize, and return a pointer to an empty arena
+Arena *mallocArena (void);
+
+
+// Return a pointer to N bytes in arena A, aligned for any type
+void *arenaAlloc (Arena *a, size_t n);
+
+
+// Return a NUL-terminated copy of the N chars at S allocated in arena A
+char *arenaStrndup (Arena *a, const char *s, size_t n);
+
+
+// Arrange for FN(P) to be called when arena A is reset or freed (calls are
+// made in reverse order, before any storage is released), and return P
+void *arenaDefer (Arena *a, void (*fn) (void *), void *p);
+
+
+// Make arena A responsible for freeing P (which was returned by malloc() or
+// realloc()) when A is reset or freed, and return P
+void *arenaAdopt (Arena *a, void *p);
+
+
+// Release everything allocated from arena A, but keep A (and its first
+// block) for reuse
+void resetArena (Arena *a);
+
+
+// Add a reference to arena A and return A.  An arena starts with one
+// reference, and freeArena() only frees it when the last one is dropped.
+// The count is not atomic: an arena must not be retained or freed by two
+// threads at once.
+Arena *arenaRetain (Arena *a);
+
+
+// Return the number of bytes of memory that arena A holds
+size_t arenaSize (Arena *a);
+
+
+// Drop a reference to arena A; if it was the last, free A and everything
+// allocated from it.  Return NULL.
+Arena *freeArena (Arena *a);
+
+#endif
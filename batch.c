@@ -0,0 +1,356 @@
+// batch.c
+//
+// Batch mode for parsley.  The main thread reads the input into chunks of
+// lines; a pool of worker threads parses the chunks, each worker with its own
+// parser context and each chunk with its own output buffer; and the main
+// thread writes the buffers to stdout in input order.
+//
+// A line that contains "<<" may have a HERE document, whose lines must be
+// read from the input before the next command.  The main thread parses such a
+// line itself, as a chunk of its own, before reading any further.
+
+#include "batch.h"
+#include "json.h"
+#include <unistd.h>
+#include <pthread.h>
+
+#define CHUNK_LINES  1024               // Max #lines in a chunk
+#define CHUNK_BYTES  (256 * 1024)       // Max #chars of lines in a chunk
+#define QUEUE_DEPTH  4                  // Max #chunks in flight per worker
+#define PROMPT_MAX   24                 // Max #chars in a prompt, plus 1
+
+typedef struct chunk {
+    char *text;                         // Lines, each NUL-terminated
+    size_t nText;                       // #chars used in text
+    size_t maxText;                     // #chars allocated for text
+    size_t *start;                      // Offset in text of each line
+    int nLines;                         // #lines in chunk
+
+    Writer *out;                        // Output for the lines (in memory)
+    size_t *end;                        // Offset in out where the output for
+                                        //   each line ends
+    bool *ok;                           // Whether each line parsed
+    bool ready;                         // Is the output complete?
+
+    struct chunk *next;                 // Next chunk in input order
+    struct chunk *nextTodo;             // Next chunk waiting for a worker
+} Chunk;
+
+typedef struct batch {
+    pthread_mutex_t lock;               // Protects everything below
+    pthread_cond_t haveWork;            // Chunk queued for workers, or EOF
+    pthread_cond_t haveOutput;          // Chunk output is complete
+    Chunk *head, *tail;                 // Chunks not yet written, in order
+    int nChunks;                        // #chunks not yet written
+    Chunk *todo, *lastTodo;             // Chunks waiting for a worker
+    bool eof;                           // No more chunks will be queued
+    const BatchOptions *opt;            // Options (read-only)
+    CacheStats stats;                   // Sum of parse cache counters
+} Batch;
+
+
+// Allocate, initialize, and return a pointer to an empty chunk
+static Chunk *mallocChunk (void)
+{
+    Chunk *c = calloc (1, sizeof(*c));
+
+    c->maxText = 4096;
+    c->text  = malloc (c->maxText);
+    c->start = malloc (CHUNK_LINES * sizeof(*c->start));
+    c->end   = malloc (CHUNK_LINES * sizeof(*c->end));
+    c->ok    = malloc (CHUNK_LINES * sizeof(*c->ok));
+    STATS_ALLOC (sizeof(*c) + c->maxText
+                 + CHUNK_LINES * (sizeof(*c->start) + sizeof(*c->end)
+                                  + sizeof(*c->ok)));
+    return c;
+}
+
+
+// Free chunk C and return NULL
+static Chunk *freeChunk (Chunk *c)
+{
+    free (c->text);
+    free (c->start);
+    free (c->end);
+    free (c->ok);
+    freeWriter (c->out);
+    free (c);
+    return NULL;
+}
+
+
+// Append the LEN chars of LINE to chunk C as a line of its own
+static void addLine (Chunk *c, char *line, size_t len)
+{
+    while (c->nText + len + 1 > c->maxText) {
+        c->maxText *= 2;
+        c->text = realloc (c->text, c->maxText);
+        STATS_ALLOC (c->maxText);
+    }
+    memcpy (c->text + c->nText, line, len);
+    c->text[c->nText + len] = '\0';
+
+    c->start[c->nLines++] = c->nText;
+    c->nText += len + 1;
+}
+
+
+// Parse the lines of chunk C using parser context P and dump them to C->out
+// (as JSON if JSON)
+static void runChunk (Parser *p, Chunk *c, bool json)
+{
+    c->out = mallocWriter (-1);
+
+    for (int i = 0; i < c->nLines; i++) {
+        CMD *cmd = parse_r (p, c->text + c->start[i]);
+        if ((c->ok[i] = (cmd != NULL))) {
+            int phase = statsPhase (PHASE_DUMP);
+            if (json)
+                jsonTree (c->out, cmd);
+            else
+                wdumpTree (c->out, cmd, 0);
+            statsPhase (phase);
+            freeCMD (cmd);
+        }
+        c->end[i] = c->out->len;
+    }
+}
+
+
+// Write to PROMPT (which has room for PROMPT_MAX chars) the prompt that
+// parsley writes before command number NCMD, and return its length
+static size_t formatPrompt (char *prompt, int nCmd)
+{
+    char digits[PROMPT_MAX];
+    char *d = digits + sizeof(digits);
+    size_t len = 0;
+
+    do {                                        // Digits from the right
+        *--d = '0' + nCmd % 10;
+        nCmd /= 10;
+    } while (nCmd > 0);
+
+    prompt[len++] = '(';
+    memcpy (prompt + len, d, digits + sizeof(digits) - d);
+    len += digits + sizeof(digits) - d;
+    memcpy (prompt + len, ")$ ", 3);
+    return len + 3;
+}
+
+
+// Write the output for chunk C to stdout, with the prompts that parsley
+// would have written before each line; *NCMD is the command number.  The
+// output is not copied: one writev() (per IOV_MAX buffers) interleaves the
+// prompts with the slices of C->out.  Only the main thread writes chunks, so
+// the prompts and iovecs can be static.  With JSON there are no prompts.
+static void writeChunk (Chunk *c, int *nCmd, bool json)
+{
+    static char prompts[CHUNK_LINES][PROMPT_MAX];
+    static struct iovec iov[2 * CHUNK_LINES];
+    size_t from = 0;
+    int nIov = 0;
+
+    for (int i = 0; i < c->nLines; i++) {
+        if (!json) {
+            iov[nIov].iov_base = prompts[i];
+            iov[nIov++].iov_len = formatPrompt (prompts[i], *nCmd);
+        }
+        if (c->end[i] > from) {
+            iov[nIov].iov_base = c->out->buf + from;
+            iov[nIov++].iov_len = c->end[i] - from;
+        }
+        from = c->end[i];
+        if (c->ok[i])
+            (*nCmd)++;
+    }
+    writevAll (STDOUT_FILENO, iov, nIov);
+}
+
+
+// Add chunk C to the end of the chunks of B; unless C is READY, also queue it
+// for a worker
+static void addChunk (Batch *b, Chunk *c, bool ready)
+{
+    pthread_mutex_lock (&b->lock);
+    c->ready = ready;
+    if (b->tail)
+        b->tail->next = c;
+    else
+        b->head = c;
+    b->tail = c;
+    b->nChunks++;
+
+    if (!ready) {
+        if (b->lastTodo)
+            b->lastTodo->nextTodo = c;
+        else
+            b->todo = c;
+        b->lastTodo = c;
+        pthread_cond_signal (&b->haveWork);
+    }
+    pthread_mutex_unlock (&b->lock);
+}
+
+
+// Wait for the first chunk of B to be complete, then write and free it
+static void writeFirst (Batch *b, int *nCmd)
+{
+    pthread_mutex_lock (&b->lock);
+    Chunk *c = b->head;
+    while (!c->ready)
+        pthread_cond_wait (&b->haveOutput, &b->lock);
+    b->head = c->next;
+    if (!b->head)
+        b->tail = NULL;
+    b->nChunks--;
+    pthread_mutex_unlock (&b->lock);
+
+    writeChunk (c, nCmd, b->opt->json);
+    freeChunk (c);
+}
+
+
+// Add the parse cache counters of parser context P to B->stats; B->lock must
+// be held
+static void addStats (Batch *b, Parser *p)
+{
+    CacheStats s;
+
+    parserCacheStats (p, &s);
+    b->stats.hits      += s.hits;
+    b->stats.misses    += s.misses;
+    b->stats.bypasses  += s.bypasses;
+    b->stats.evictions += s.evictions;
+    b->stats.entries   += s.entries;
+    b->stats.bytes     += s.bytes;
+}
+
+
+// Worker thread: parse queued chunks of the batch at ARG until EOF
+static void *worker (void *arg)
+{
+    Batch *b = arg;
+    Stats *stats = b->opt->stats ? mallocStats() : NULL;
+    if (stats)
+        statsStart (stats);
+    Parser *p = mallocParser();
+    parserSetCache (p, b->opt->cacheBytes);
+
+    pthread_mutex_lock (&b->lock);
+    for ( ; ; ) {
+        while (!b->todo && !b->eof)
+            pthread_cond_wait (&b->haveWork, &b->lock);
+        Chunk *c = b->todo;
+        if (!c)
+            break;
+        b->todo = c->nextTodo;
+        if (!b->todo)
+            b->lastTodo = NULL;
+        pthread_mutex_unlock (&b->lock);
+
+        runChunk (p, c, b->opt->json);
+
+        pthread_mutex_lock (&b->lock);
+        c->ready = true;
+        pthread_cond_broadcast (&b->haveOutput);
+    }
+    addStats (b, p);
+    pthread_mutex_unlock (&b->lock);
+
+    freeParser (p);
+    if (stats) {
+        statsStop();
+        pthread_mutex_lock (&b->lock);
+        statsMerge (b->opt->stats, stats);
+        pthread_mutex_unlock (&b->lock);
+        freeStats (stats);
+    }
+    return NULL;
+}
+
+
+int batchParse (FILE *in, const BatchOptions *opt, CacheStats *stats)
+{
+    int nThreads = opt->nThreads;
+    Batch b = {.head = NULL, .tail = NULL, .nChunks = 0,
+               .todo = NULL, .lastTodo = NULL, .eof = false,
+               .opt = opt, .stats = {0}};
+    pthread_mutex_init (&b.lock, NULL);
+    pthread_cond_init (&b.haveWork, NULL);
+    pthread_cond_init (&b.haveOutput, NULL);
+
+    pthread_t *tid = malloc (nThreads * sizeof(*tid));
+    for (int i = 0; i < nThreads; i++) {
+        if (pthread_create (&tid[i], NULL, worker, &b) != 0) {
+            perror ("parsley: pthread_create");
+            exit (EXIT_FAILURE);
+        }
+    }
+
+    Parser *p = mallocParser();                 // For lines with HERE docs,
+    parserSetInput (p, in);                     //   which read from IN
+    parserSetHereMax (p, opt->hereMax);
+    parserSetCache (p, opt->cacheBytes);        // Only to count bypasses
+
+    int nCmd = 1;                               // Command number
+    Chunk *c = NULL;                            // Chunk being filled
+    char *line = NULL;                          // Space for line read
+    size_t nLine = 0;                           // #chars allocated
+    ssize_t len;
+
+    while ((len = getline (&line, &nLine, in)) > 0) {
+        if (strstr (line, "<<")) {              // May read a HERE document?
+            if (c)                              //   Queue the lines before it
+                addChunk (&b, c, false);
+            c = mallocChunk();                  //   and parse it here
+            addLine (c, line, len);
+            runChunk (p, c, opt->json);
+            addChunk (&b, c, true);
+            c = NULL;
+
+        } else {
+            if (!c)
+                c = mallocChunk();
+            addLine (c, line, len);
+            if (c->nLines == CHUNK_LINES || c->nText >= CHUNK_BYTES) {
+                addChunk (&b, c, false);
+                c = NULL;
+            }
+        }
+
+        while (b.nChunks > QUEUE_DEPTH * nThreads)  // Bound memory in use
+            writeFirst (&b, &nCmd);
+    }
+    if (c)
+        addChunk (&b, c, false);
+
+    pthread_mutex_lock (&b.lock);               // Tell workers to finish
+    b.eof = true;
+    pthread_cond_broadcast (&b.haveWork);
+    pthread_mutex_unlock (&b.lock);
+
+    while (b.head)                              // Write what is left
+        writeFirst (&b, &nCmd);
+
+    for (int i = 0; i < nThreads; i++)
+        pthread_join (tid[i], NULL);
+
+    if (!opt->json) {
+        char prompt[PROMPT_MAX + 1];            // Final prompt and newline
+        size_t n = formatPrompt (prompt, nCmd);
+        prompt[n++] = '\n';
+        writeAll (STDOUT_FILENO, prompt, n);
+    }
+
+    addStats (&b, p);
+    if (stats)
+        *stats = b.stats;
+
+    free (tid);
+    free (line);
+    freeParser (p);
+    pthread_mutex_destroy (&b.lock);
+    pthread_cond_destroy (&b.haveWork);
+    pthread_cond_destroy (&b.haveOutput);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,32 @@
+// batch.h
+//
+// Header file for batch mode of parsley: parse a file of command lines on a
+// pool of worker threads and write the output in line order
+
+#ifndef BATCH_INCLUDED
+#define BATCH_INCLUDED          // batch.h has been #include-d
+
+#include "parsley.h"
+#include "stats.h"
+
+// Options for batchParse()
+typedef struct batchOptions {
+    int nThreads;                       // #worker threads
+    size_t hereMax;                     // Longest HERE document kept in
+                                        //   memory (see parserSetHereMax())
+    size_t cacheBytes;                  // Size of the parse cache of each
+                                        //   worker (see parserSetCache())
+    bool json;                          // Write JSON (see json.h)?
+    Stats *stats;                       // Counters for --stats (each worker
+                                        //   adds its own at the end), or NULL
+} BatchOptions;
+
+
+// Parse the lines read from IN using OPT->nThreads worker threads and write
+// to stdout exactly what parsley writes when reading IN as stdin (prompts and
+// dumpTree() output, in line order), or if OPT->json, what parsley --json
+// writes.  If STATS is not NULL, set *STATS to the sum of the counters of the
+// parse caches.  Return EXIT_SUCCESS or EXIT_FAILURE.
+int batchParse (FILE *in, const BatchOptions *opt, CacheStats *stats);
+
+#endif
@@ -0,0 +1,279 @@
+// genCorpus.c
+//
+// Generator of synthetic corpora for parseBench: random command lines that
+// follow the grammar in parsley.h, derived top-down from [command], with the
+// shape of each corpus set by a profile that stresses one part of the parser.
+//
+// Usage: genCorpus [-p PROFILE] [-n LINES] [-s SEED]
+//
+// PROFILE is one of
+//
+//   mixed     a bit of everything (the default)
+//   pipes     long pipelines
+//   nest      deeply nested ( ... )
+//   locals    many local variables in each prefix
+//   redirs    redirections on every stage
+//   escapes   long TEXT tokens with many backslash escapes
+//   heredoc   large HERE documents
+//
+// LINES is the number of command lines (the default depends on the profile;
+// the lines of HERE documents are not counted), and SEED seeds the random
+// numbers, so the same arguments always give the same corpus.  Only valid
+// commands are generated, and only the redirections that the lexer knows
+// (<, <<, >, >>).
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+// Shape of a corpus: upper bounds (the actual numbers are random between 1
+// or 0 and the bound) and percentages of choices
+typedef struct {
+    const char *name;
+    int lines;                          // Default number of command lines
+    int maxSequence;                    // #[and-or] in a [sequence]
+    int maxAndOr;                       // #[pipeline] in an [and-or]
+    int maxPipe;                        // #[stage] in a [pipeline]
+    int maxDepth;                       // Depth of nested [subcmd]
+    int subcmdPct;                      // % of [stage] that are [subcmd]
+    int maxLocals;                      // #[local] in a [prefix]
+    int redirectPct;                    // % of [stage] with each redirection
+    int maxArgs;                        // #TEXT in a [suffix]
+    int wordLen;                        // Length of a TEXT token
+    int escapePct;                      // % of chars in TEXT that are escaped
+    int herePct;                        // % of input redirections that are <<
+    int hereLines;                      // #lines in a HERE document
+} Profile;
+
+static const Profile profiles[] = {
+  // name       lines  seq andor pipe depth sub% locals red% args word esc% here% hereLines
+    {"mixed",    5000,  3,   3,    4,   3,   10,    2,   30,   4,   8,   5,   5,     8},
+    {"pipes",    5000,  1,   1,   64,   0,    0,    0,   10,   3,   6,   0,   0,     0},
+    {"nest",     5000,  1,   1,    1,  40,   95,    1,   20,   2,   5,   0,   0,     0},
+    {"locals",  10000,  1,   1,    2,   0,    0,   32,   10,   2,   6,   0,   0,     0},
+    {"redirs",  10000,  2,   2,    6,   2,   20,    0,  100,   2,   6,   0,   0,     0},
+    {"escapes", 10000,  1,   1,    2,   0,    0,    1,   10,   6, 200,  30,   0,     0},
+    {"heredoc",   200,  1,   1,    2,   0,    0,    0,  100,   2,   6,   0, 100,  2000},
+};
+
+static const Profile *prof;             // Profile in use
+static FILE *out;                       // Corpus
+static char *here;                      // HERE documents to write after the
+static size_t hereLen, hereSize;        //   current line
+static int nHere;                       // #HERE documents so far
+
+static uint64_t state = 88172645463325252ULL;   // State of xorshift64
+
+
+// Return a random number in [0, N)
+static int rnd (int n)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return n > 0 ? (int) (state % n) : 0;
+}
+
+
+// Return true PCT% of the time
+static bool chance (int pct)
+{
+    return rnd (100) < pct;
+}
+
+
+// Write a random TEXT token of about prof->wordLen chars, escaping some of
+// them (including metachars, which must then be escaped)
+static void genText (void)
+{
+    static const char plain[] = "abcdefghijklmnopqrstuvwxyz0123456789-_./,:";
+    static const char special[] = " |&;<>()#\\";
+    int len = 1 + rnd (prof->wordLen);
+
+    fputc (plain[rnd (26)], out);               // Not a digit or a #
+    for (int i = 1; i < len; i++) {
+        if (chance (prof->escapePct)) {
+            fputc ('\\', out);
+            fputc (special[rnd (sizeof(special) - 1)], out);
+        } else {
+            fputc (plain[rnd (sizeof(plain) - 1)], out);
+        }
+    }
+}
+
+
+// Write a [local] VARIABLE=VALUE
+static void genLocal (void)
+{
+    static const char first[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ_abcxyz";
+    static const char rest[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+
+    fputc (first[rnd (sizeof(first) - 1)], out);
+    for (int n = rnd (8); n > 0; n--)
+        fputc (rest[rnd (sizeof(rest) - 1)], out);
+    fputc ('=', out);
+    genText();
+}
+
+
+// Queue a HERE document ended by the line TERM for after the current line
+static void queueHere (const char *term)
+{
+    for (int i = 0; i < prof->hereLines; i++) {
+        char line[128];
+        int n = snprintf (line, sizeof(line), "line %d of %s: %*s\n",
+                          i, term, rnd (64), "x");
+        if (hereLen + n + 1 > hereSize) {
+            hereSize = 2 * (hereLen + n + 1);
+            here = realloc (here, hereSize);
+        }
+        memcpy (here + hereLen, line, n);
+        hereLen += n;
+    }
+    size_t n = strlen (term);
+    if (hereLen + n + 2 > hereSize) {
+        hereSize = 2 * (hereLen + n + 2);
+        here = realloc (here, hereSize);
+    }
+    memcpy (here + hereLen, term, n);
+    hereLen += n;
+    here[hereLen++] = '\n';
+}
+
+
+// Write the redirections of a stage: at most one for stdin and one for
+// stdout, each with probability prof->redirectPct
+static void genRedirects (void)
+{
+    if (chance (prof->redirectPct)) {
+        if (chance (prof->herePct)) {
+            char term[32];
+            snprintf (term, sizeof(term), "EOF%d", nHere++);
+            fprintf (out, " <<%s", term);
+            queueHere (term);
+        } else {
+            fputs (" <", out);
+            genText();
+        }
+    }
+    if (chance (prof->redirectPct)) {
+        fputs (rnd (2) ? " >" : " >>", out);
+        genText();
+    }
+}
+
+
+// Write a [prefix] of up to prof->maxLocals locals
+static void genLocals (void)
+{
+    for (int n = rnd (prof->maxLocals + 1); n > 0; n--) {
+        genLocal();
+        fputc (' ', out);
+    }
+}
+
+
+static void genCommand (int depth);
+
+
+// Write a [stage] at nesting depth DEPTH: a [simple] or a [subcmd]
+static void genStage (int depth)
+{
+    genLocals();
+    if (depth < prof->maxDepth && chance (prof->subcmdPct)) {
+        fputc ('(', out);
+        genCommand (depth + 1);
+        fputc (')', out);
+    } else {
+        genText();
+        for (int n = rnd (prof->maxArgs + 1); n > 0; n--) {
+            fputc (' ', out);
+            genText();
+        }
+    }
+    genRedirects();
+}
+
+
+// Write a [pipeline], [and-or], and [sequence] at nesting depth DEPTH
+static void genPipeline (int depth)
+{
+    genStage (depth);
+    for (int n = rnd (prof->maxPipe); n > 0; n--) {
+        fputs (" | ", out);
+        genStage (depth);
+    }
+}
+
+static void genAndOr (int depth)
+{
+    genPipeline (depth);
+    for (int n = rnd (prof->maxAndOr); n > 0; n--) {
+        fputs (rnd (2) ? " && " : " || ", out);
+        genPipeline (depth);
+    }
+}
+
+static void genSequence (int depth)
+{
+    genAndOr (depth);
+    for (int n = rnd (prof->maxSequence); n > 0; n--) {
+        fputs (rnd (2) ? " ; " : " & ", out);
+        genAndOr (depth);
+    }
+}
+
+
+// Write a [command] at nesting depth DEPTH: a [sequence], sometimes followed
+// by ; or &
+static void genCommand (int depth)
+{
+    genSequence (depth);
+    if (chance (10))
+        fputs (rnd (2) ? " ;" : " &", out);
+}
+
+
+int main (int argc, char *argv[])
+{
+    const char *name = "mixed";
+    int lines = -1;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "p:n:s:")) != -1) {
+        if (opt == 'p')
+            name = optarg;
+        else if (opt == 'n')
+            lines = atoi (optarg);
+        else if (opt == 's')
+            state ^= strtoull (optarg, NULL, 0) * 0x9E3779B97F4A7C15ULL;
+        else {
+            fprintf (stderr, "usage: genCorpus [-p PROFILE] [-n LINES] "
+                             "[-s SEED]\n");
+            return EXIT_FAILURE;
+        }
+    }
+    for (size_t i = 0; i < sizeof(profiles) / sizeof(*profiles); i++)
+        if (strcmp (profiles[i].name, name) == 0)
+            prof = &profiles[i];
+    if (!prof) {
+        fprintf (stderr, "genCorpus: unknown profile %s\n", name);
+        return EXIT_FAILURE;
+    }
+    if (lines < 0)
+        lines = prof->lines;
+
+    out = stdout;
+    for (int i = 0; i < lines; i++) {
+        genCommand (0);
+        fputc ('\n', out);
+        fwrite (here, 1, hereLen, out);
+        hereLen = 0;
+    }
+    free (here);
+    return EXIT_SUCCESS;
+}
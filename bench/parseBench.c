@@ -0,0 +1,326 @@
+// parseBench.c
+//
+// End-to-end benchmark of the parser: for each corpus (e.g., one made by
+// genCorpus), parse every line with parse_r() (i.e., parse() with a context
+// of its own), dump the tree with wdumpTree() (to /dev/null, as dumpTree()
+// would to stdout), and free it with freeCMD(); repeat until enough time has
+// passed, then report
+//
+//   lines/s         command lines parsed per second (HERE document lines,
+//                   which the parser reads itself, are not counted)
+//   bytes/s         bytes of the corpus (including HERE documents) per second
+//   allocs/line     calls to malloc(), calloc(), and realloc() made by the
+//                   parser per line (counted by wrapping them at link time;
+//                   see the Makefile)
+//   peak RSS        largest resident set size while parsing the corpus
+//
+// Each corpus is run in a child process of its own, so that its peak RSS is
+// not that of the corpora before it.
+//
+// Usage: parseBench [-t SECONDS] [-l LABEL] [-o RESULTS] [-b BASELINE] CORPUS...
+//
+// SECONDS is the least time to spend on each corpus (default 1).  With -o,
+// the results are also written to the file RESULTS as JSON, one corpus per
+// line, tagged with LABEL (e.g., a release or a commit).  With -b, each
+// result is compared with the one for the same corpus in the file BASELINE
+// (an earlier RESULTS), and the exit status is 1 if lines/s fell or
+// allocs/line or peak RSS grew by more than 10%.
+
+#include "../parsley.h"
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define MAX_CORPORA 64                  // Max #corpora in one run
+#define TOLERANCE   0.10                // Change that counts as a regression
+
+// Result for one corpus
+typedef struct {
+    char corpus[64];                    // Name: base name of the file less .txt
+    long lines;                         // #command lines in one pass
+    long bytes;                         // #bytes in one pass
+    long errors;                        // #lines with parse errors in one pass
+    int passes;                         // #passes made
+    double seconds;                     // Time for all the passes
+    double linesPerSec;
+    double bytesPerSec;
+    double allocsPerLine;
+    long peakRssKB;
+} Result;
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocation counters: the link step wraps malloc(), calloc(), and realloc()
+// (-Wl,--wrap=...), so calls from the parser's objects come here.  Calls from
+// inside the C library (e.g., by getline()) are not counted.
+
+static unsigned long nAllocs;           // #calls so far
+
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t n, size_t size);
+void *__real_realloc (void *p, size_t size);
+
+void *__wrap_malloc (size_t size)
+{
+    nAllocs++;
+    return __real_malloc (size);
+}
+
+void *__wrap_calloc (size_t n, size_t size)
+{
+    nAllocs++;
+    return __real_calloc (n, size);
+}
+
+void *__wrap_realloc (void *p, size_t size)
+{
+    nAllocs++;
+    return __real_realloc (p, size);
+}
+
+
+// Return the current time in seconds
+static double now (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+// Parse the corpus in IN once with parser context P, dumping to W; set
+// *LINES, *BYTES, and *ERRORS
+static void onePass (Parser *p, FILE *in, Writer *w,
+                     long *lines, long *bytes, long *errors)
+{
+    static char *line = NULL;
+    static size_t nLine = 0;
+    CMD *cmd;
+
+    rewind (in);
+    *lines = *errors = 0;
+    while (getline (&line, &nLine, in) > 0) {
+        (*lines)++;
+        if ((cmd = parse_r (p, line)) != NULL) {
+            wdumpTree (w, cmd, 0);
+            cmd = freeCMD (cmd);
+        } else if (line[strspn (line, " \t\n")] != '\0') {
+            (*errors)++;
+        }
+    }
+    flushWriter (w);
+    *bytes = ftell (in);
+}
+
+
+// Run the benchmark on the corpus in the file NAME for at least SECONDS and
+// set *R; return false if NAME cannot be read
+static bool runCorpus (const char *name, double seconds, Result *r)
+{
+    FILE *in = fopen (name, "r");
+    if (!in) {
+        perror (name);
+        return false;
+    }
+
+    char *copy = strdup (name);
+    snprintf (r->corpus, sizeof(r->corpus), "%s", basename (copy));
+    free (copy);
+    char *dot = strrchr (r->corpus, '.');
+    if (dot && strcmp (dot, ".txt") == 0)
+        *dot = '\0';
+
+    Parser *p = mallocParser();
+    parserSetInput (p, in);
+    int fd = open ("/dev/null", O_WRONLY);
+    Writer *w = mallocWriter (fd);
+
+    onePass (p, in, w, &r->lines, &r->bytes, &r->errors);     // Warm up
+
+    unsigned long allocs = nAllocs;
+    double start = now();
+    r->passes = 0;
+    do {
+        onePass (p, in, w, &r->lines, &r->bytes, &r->errors);
+        r->passes++;
+    } while ((r->seconds = now() - start) < seconds);
+    allocs = nAllocs - allocs;
+
+    struct rusage ru;
+    getrusage (RUSAGE_SELF, &ru);
+    r->peakRssKB = ru.ru_maxrss;
+
+    long lines = r->lines * (long) r->passes;
+    r->linesPerSec = lines / r->seconds;
+    r->bytesPerSec = r->bytes * (double) r->passes / r->seconds;
+    r->allocsPerLine = lines ? (double) allocs / lines : 0;
+
+    freeWriter (w);
+    close (fd);
+    freeParser (p);
+    fclose (in);
+    return true;
+}
+
+
+// Same as runCorpus(), but in a child process; return false on error
+static bool forkCorpus (const char *name, double seconds, Result *r)
+{
+    int pipeFd[2];
+    if (pipe (pipeFd) < 0) {
+        perror ("pipe");
+        return false;
+    }
+    fflush (stdout);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror ("fork");
+        return false;
+    }
+    if (pid == 0) {
+        close (pipeFd[0]);
+        bool ok = runCorpus (name, seconds, r)
+                    && writeAll (pipeFd[1], (char *) r, sizeof(*r));
+        _exit (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close (pipeFd[1]);
+    ssize_t n = read (pipeFd[0], r, sizeof(*r));
+    close (pipeFd[0]);
+    int status;
+    waitpid (pid, &status, 0);
+    return n == sizeof(*r) && WIFEXITED (status)
+                           && WEXITSTATUS (status) == EXIT_SUCCESS;
+}
+
+
+// Write result R as one line of JSON to OUT, tagged with LABEL
+static void writeResult (FILE *out, const char *label, const Result *r)
+{
+    fprintf (out, "{\"label\":\"%s\",\"corpus\":\"%s\",\"lines\":%ld,"
+                  "\"bytes\":%ld,\"errors\":%ld,\"passes\":%d,"
+                  "\"seconds\":%.3f,\"linesPerSec\":%.0f,"
+                  "\"bytesPerSec\":%.0f,\"allocsPerLine\":%.2f,"
+                  "\"peakRssKB\":%ld}\n",
+             label, r->corpus, r->lines, r->bytes, r->errors, r->passes,
+             r->seconds, r->linesPerSec, r->bytesPerSec, r->allocsPerLine,
+             r->peakRssKB);
+}
+
+
+// Find the result for corpus NAME in the file BASE (written by writeResult())
+// and set *R to it; return false if there is none
+static bool readResult (const char *base, const char *name, Result *r)
+{
+    FILE *in = fopen (base, "r");
+    if (!in) {
+        perror (base);
+        return false;
+    }
+
+    char *line = NULL;
+    size_t nLine = 0;
+    bool found = false;
+    while (!found && getline (&line, &nLine, in) > 0) {
+        char *s = strstr (line, "\"corpus\":\"");
+        if (!s || sscanf (s, "\"corpus\":\"%63[^\"]\",\"lines\":%ld,"
+                             "\"bytes\":%ld,\"errors\":%ld,\"passes\":%d,"
+                             "\"seconds\":%lf,\"linesPerSec\":%lf,"
+                             "\"bytesPerSec\":%lf,\"allocsPerLine\":%lf,"
+                             "\"peakRssKB\":%ld",
+                         r->corpus, &r->lines, &r->bytes, &r->errors,
+                         &r->passes, &r->seconds, &r->linesPerSec,
+                         &r->bytesPerSec, &r->allocsPerLine,
+                         &r->peakRssKB) != 10)
+            continue;
+        found = (strcmp (r->corpus, name) == 0);
+    }
+    free (line);
+    fclose (in);
+    return found;
+}
+
+
+// Print the change from OLD to NEW of a figure called WHAT, where HIGHER says
+// whether higher is better; return true if it is a regression
+static bool compare (const char *what, double old, double new, bool higher)
+{
+    double change = old ? (new - old) / old : 0;
+    bool worse = higher ? change < -TOLERANCE : change > TOLERANCE;
+
+    printf ("  %s %+.1f%%%s", what, 100 * change, worse ? " (REGRESSION)" : "");
+    return worse;
+}
+
+
+int main (int argc, char *argv[])
+{
+    double seconds = 1;
+    const char *label = "";
+    const char *output = NULL;
+    const char *baseline = NULL;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "t:l:o:b:")) != -1) {
+        if (opt == 't')
+            seconds = atof (optarg);
+        else if (opt == 'l')
+            label = optarg;
+        else if (opt == 'o')
+            output = optarg;
+        else if (opt == 'b')
+            baseline = optarg;
+        else
+            optind = argc + 1;
+    }
+    if (optind >= argc || argc - optind > MAX_CORPORA) {
+        fprintf (stderr, "usage: parseBench [-t SECONDS] [-l LABEL] "
+                         "[-o RESULTS] [-b BASELINE] CORPUS...\n");
+        return EXIT_FAILURE;
+    }
+
+    Result results[MAX_CORPORA];
+    int nResults = 0;
+    bool regressed = false;
+
+    printf ("%-10s %10s %12s %10s %11s %8s\n",
+            "corpus", "lines/s", "MB/s", "allocs/ln", "peak RSS", "errors");
+    for (int i = optind; i < argc; i++) {
+        Result *r = &results[nResults];
+        if (!forkCorpus (argv[i], seconds, r))
+            return EXIT_FAILURE;
+        nResults++;
+
+        printf ("%-10s %10.0f %12.2f %10.2f %8ld kB %8ld\n",
+                r->corpus, r->linesPerSec, r->bytesPerSec / 1e6,
+                r->allocsPerLine, r->peakRssKB, r->errors);
+
+        Result old;
+        if (baseline && readResult (baseline, r->corpus, &old)) {
+            printf ("%-10s", "");
+            regressed |= compare ("lines/s", old.linesPerSec,
+                                  r->linesPerSec, true);
+            regressed |= compare ("allocs/line", old.allocsPerLine,
+                                  r->allocsPerLine, false);
+            regressed |= compare ("peak RSS", old.peakRssKB,
+                                  r->peakRssKB, false);
+            putchar ('\n');
+        }
+    }
+
+    if (output) {
+        FILE *out = fopen (output, "w");
+        if (!out) {
+            perror (output);
+            return EXIT_FAILURE;
+        }
+        for (int i = 0; i < nResults; i++)
+            writeResult (out, label, &results[i]);
+        fclose (out);
+    }
+    return regressed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,117 @@
+// scanBench.c
+//
+// Benchmark for the TEXT-token scanners in scan.c.  For lines whose arguments
+// are long (base64 blobs, paths, JSON payloads) of several sizes, report how
+// many bytes per second each scanner supported by this CPU gets through when
+// it is used to split the whole line into tokens.
+//
+// Usage: scanBench [SECONDS]      (time per measurement; default 0.2)
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../scan.h"
+
+// Return the current time in seconds
+static double now (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+
+// Fill LINE with LENGTH chars: a command name and arguments of about ARGLEN
+// chars each, drawn from the chars in ALPHABET and separated by spaces
+static void makeLine (char *line, int length, int argLen, const char *alphabet)
+{
+    int n = strlen (alphabet);
+    int i = 0;
+
+    memcpy (line, "cmd ", 4);
+    for (i = 4; i < length - 1; i++)
+        line[i] = ((i - 4) % (argLen + 1) == argLen) ? ' '
+                                                     : alphabet[rand() % n];
+    line[length - 1] = '\n';
+    line[length] = '\0';
+}
+
+
+// Split the LENGTH chars of LINE into tokens with SCAN and return the number
+// of tokens (so that the work cannot be optimized away)
+static int splitLine (Scanner scan, const char *line, int length)
+{
+    int nTokens = 0;
+
+    for (int i = 0; i < length; ) {
+        if (CLASS(line[i]) & CC_DELIM) {
+            i++;
+            continue;
+        }
+        i = scan (line, i+1, length);
+        nTokens++;
+    }
+    return nTokens;
+}
+
+
+int main (int argc, char *argv[])
+{
+    double seconds = (argc > 1) ? atof (argv[1]) : 0.2;
+
+    static const struct {
+        const char *name;
+        const char *alphabet;
+    } kinds[] = {
+        {"base64", "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz"
+                   "0123456789+/="},
+        {"path",   "abcdefghijklmnopqrstuvwxyz0123456789_-./"},
+        {"json",   "{}[]\":,abcdefghijklmnopqrstuvwxyz0123456789"},
+    };
+    static const int argLens[] = {1024, 4096, 16384, 65536};
+
+    Scanner scanners[3];
+    int nScanners = 0;
+    Scanner best = bestScanner();
+    scanners[nScanners++] = scanScalar;
+    if (best != scanScalar)
+        scanners[nScanners++] = scanSSE2;
+    if (best == scanAVX2)
+        scanners[nScanners++] = scanAVX2;
+
+    int length = 1 << 20;                       // 1 MB line
+    char *line = malloc (length + 1);
+
+    printf ("%-8s %8s", "args", "argLen");
+    for (int s = 0; s < nScanners; s++)
+        printf (" %12s", scannerName (scanners[s]));
+    printf ("   (MB/s)\n");
+
+    for (int k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        for (int a = 0; a < sizeof(argLens) / sizeof(argLens[0]); a++) {
+            makeLine (line, length, argLens[a], kinds[k].alphabet);
+            printf ("%-8s %8d", kinds[k].name, argLens[a]);
+
+            int expect = splitLine (scanScalar, line, length);
+            for (int s = 0; s < nScanners; s++) {
+                long bytes = 0;
+                double start = now(), elapsed;
+                do {
+                    if (splitLine (scanners[s], line, length) != expect) {
+                        fprintf (stderr, "scanBench: %s disagrees\n",
+                                 scannerName (scanners[s]));
+                        return EXIT_FAILURE;
+                    }
+                    bytes += length;
+                } while ((elapsed = now() - start) < seconds);
+                printf (" %12.0f", bytes / elapsed / 1e6);
+            }
+            printf ("\n");
+        }
+    }
+
+    free (line);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,343 @@
+// blob.c
+//
+// Binary form of a command tree; see blob.h.  cmdToBlob() writes the tree to
+// a memory Writer in post order, so each node is written after everything it
+// refers to and no offset has to be patched later except those in the header.
+// The tree may be as deep as a pipeline is long, so the walk uses an explicit
+// stack (see walk.h) rather than recursion.
+
+#include "blob.h"
+#include "walk.h"
+#include <unistd.h>
+
+#define BLOB_ALIGN 4                    // Alignment of everything in a blob
+
+// Append NULs to W until its length is a multiple of BLOB_ALIGN
+static void pad (Writer *w)
+{
+    while (w->len % BLOB_ALIGN)
+        wrChar (w, '\0');
+}
+
+
+// Append the string S (with its NUL) to W and return its offset, or return 0
+// if S is NULL
+static uint32_t putString (Writer *w, const char *s)
+{
+    if (!s)
+        return 0;
+
+    uint32_t off = w->len;
+    wrBytes (w, s, strlen (s) + 1);
+    pad (w);
+    return off;
+}
+
+
+// Append the N strings S[0], ..., S[N-1] to W, then an array of their offsets,
+// and return the offset of the array (or 0 if N is 0)
+static uint32_t putStrings (Writer *w, char **s, int n)
+{
+    if (n <= 0 || !s)
+        return 0;
+
+    uint32_t *offs = malloc (n * sizeof(*offs));
+    for (int i = 0; i < n; i++)
+        offs[i] = putString (w, s[i]);
+
+    uint32_t off = w->len;
+    wrBytes (w, (char *) offs, n * sizeof(*offs));
+    free (offs);
+    return off;
+}
+
+
+// Append the LEN chars of the HERE document in the file FD (see fromFd) to W
+// as a string, reading it straight into the buffer of W; return its offset
+// and set *N to the number of chars read
+static uint32_t putHereFd (Writer *w, int fd, size_t len, uint32_t *n)
+{
+    uint32_t off = w->len;
+    size_t got = 0;
+
+    wrReserve (w, len + 1);
+    while (got < len) {
+        ssize_t k = pread (fd, w->buf + w->len + got, len - got, got);
+        if (k <= 0)
+            break;
+        got += k;
+    }
+    w->len += got;
+    wrChar (w, '\0');
+    pad (w);
+
+    *n = got;
+    return off;
+}
+
+
+// Append the node C, whose children are at offsets LEFT and RIGHT (or 0),
+// to W after its strings and arrays, and return its offset
+static uint32_t putNode (Writer *w, CMD *c, uint32_t left, uint32_t right)
+{
+    BlobCmd b;
+    b.left   = left;
+    b.right  = right;
+
+    b.type   = c->type;
+    b.argc   = c->argc;
+    b.argv   = putStrings (w, c->argv, c->argc);
+    b.nLocal = c->nLocal;
+    b.locVar = putStrings (w, c->locVar, c->nLocal);
+    b.locVal = putStrings (w, c->locVal, c->nLocal);
+
+    b.fromType = c->fromType;
+    b.fromLen  = 0;
+    if (c->fromFile == NULL && c->fromFd >= 0)
+        b.fromFile = putHereFd (w, c->fromFd, c->fromLen, &b.fromLen);
+    else if ((b.fromFile = putString (w, c->fromFile)) != 0
+                 && c->fromType == RED_IN_HERE)
+        b.fromLen = strlen (c->fromFile);
+
+    b.toType  = c->toType;
+    b.toFile  = putString (w, c->toFile);
+    b.errType = c->errType;
+    b.errFile = putString (w, c->errFile);
+
+    uint32_t off = w->len;
+    wrBytes (w, (char *) &b, sizeof(b));
+    return off;
+}
+
+
+// How far the visit of a node on the stack in putCmd() has got
+#define OPEN  0                         // Nothing written yet
+#define LEFT  1                         // Left subtree written
+#define RIGHT 2                         // Right subtree written too
+
+// Append the tree rooted at C to W in post order and return the offset of its
+// root node, or 0 if C is NULL.  The offsets of the subtrees that have been
+// written but whose parents have not are kept on a second stack, on which
+// the right subtree of a node (if any) is above its left.
+static uint32_t putCmd (Writer *w, CMD *c)
+{
+    if (!c)
+        return 0;
+
+    Walk stack;                                 // Nodes being visited
+    uint32_t *done = NULL;                      // Offsets of subtrees written
+    size_t nDone = 0, maxDone = 0;
+
+    walkInit (&stack);
+    walkPush (&stack, c, OPEN);
+    while (stack.len > 0) {
+        WalkFrame *f = walkTop (&stack);
+        c = f->cmd;
+
+        if (f->n == OPEN) {
+            f->n = LEFT;
+            if (c->left)
+                walkPush (&stack, c->left, OPEN);
+        } else if (f->n == LEFT) {
+            f->n = RIGHT;
+            if (c->right)
+                walkPush (&stack, c->right, OPEN);
+        } else {
+            walkPop (&stack);
+            uint32_t right = c->right ? done[--nDone] : 0;
+            uint32_t left  = c->left  ? done[--nDone] : 0;
+            if (nDone == maxDone) {
+                maxDone = maxDone ? 2 * maxDone : 64;
+                done = realloc (done, maxDone * sizeof(*done));
+            }
+            done[nDone++] = putNode (w, c, left, right);
+        }
+    }
+
+    uint32_t root = done[0];
+    walkFree (&stack);
+    free (done);
+    return root;
+}
+
+
+void *cmdToBlob (CMD *c, size_t *len)
+{
+    Writer *w = mallocWriter (-1);
+    BlobHeader h;
+
+    memcpy (h.magic, BLOB_MAGIC, sizeof(h.magic));
+    h.version = BLOB_VERSION;
+    wrBytes (w, (char *) &h, sizeof(h));
+
+    uint32_t root = putCmd (w, c);
+    if (w->len > UINT32_MAX) {                  // Offsets have wrapped
+        freeWriter (w);
+        return NULL;
+    }
+
+    BlobHeader *hp = (BlobHeader *) w->buf;
+    hp->size = w->len;
+    hp->root = root;
+
+    void *blob = w->buf;                        // Keep the buffer but not
+    *len = w->len;                              //   the writer
+    w->buf = NULL;
+    freeWriter (w);
+    return blob;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Reader
+
+const BlobCmd *blobRoot (const void *blob)
+{
+    return blobNode (blob, ((const BlobHeader *) blob)->root);
+}
+
+
+const BlobCmd *blobNode (const void *blob, uint32_t off)
+{
+    return off ? (const BlobCmd *) ((const char *) blob + off) : NULL;
+}
+
+
+const char *blobString (const void *blob, uint32_t off)
+{
+    return off ? (const char *) blob + off : NULL;
+}
+
+
+// Return entry I of the array of string offsets at offset OFF in BLOB
+static const char *blobEntry (const void *blob, uint32_t off, int i)
+{
+    const uint32_t *a = (const uint32_t *) ((const char *) blob + off);
+    return blobString (blob, a[i]);
+}
+
+
+const char *blobArgv (const void *blob, const BlobCmd *c, int i)
+{
+    return blobEntry (blob, c->argv, i);
+}
+
+
+const char *blobLocVar (const void *blob, const BlobCmd *c, int i)
+{
+    return blobEntry (blob, c->locVar, i);
+}
+
+
+const char *blobLocVal (const void *blob, const BlobCmd *c, int i)
+{
+    return blobEntry (blob, c->locVal, i);
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Validation
+
+// Is OFF a possible offset of an object of N bytes that lies in BLOB before
+// offset LIMIT?
+static bool inBounds (uint32_t off, size_t n, uint32_t limit)
+{
+    return off % BLOB_ALIGN == 0
+        && off >= sizeof(BlobHeader)
+        && off < limit
+        && n <= limit - off;
+}
+
+
+// Is OFF the offset of a NUL-terminated string in BLOB before offset LIMIT
+// (or 0, if NULL is allowed)?
+static bool checkString (const char *blob, uint32_t off, uint32_t limit,
+                         bool null)
+{
+    if (off == 0)
+        return null;
+    return inBounds (off, 1, limit) && memchr (blob + off, '\0', limit - off);
+}
+
+
+// Is OFF the offset of an array of N string offsets before offset LIMIT?
+static bool checkStrings (const char *blob, uint32_t off, int n,
+                          uint32_t limit)
+{
+    if (n < 0)
+        return false;
+    if (n == 0)
+        return true;
+    if (!inBounds (off, (size_t) n * sizeof(uint32_t), limit))
+        return false;
+
+    const uint32_t *a = (const uint32_t *) (blob + off);
+    for (int i = 0; i < n; i++)
+        if (!checkString (blob, a[i], off, false))
+            return false;
+    return true;
+}
+
+
+bool blobCheck (const void *blob, size_t len)
+{
+    const char *b = blob;
+    const BlobHeader *h = blob;
+
+    if ((uintptr_t) blob % BLOB_ALIGN != 0
+          || len < sizeof(*h) || len > UINT32_MAX
+          || memcmp (h->magic, BLOB_MAGIC, sizeof(h->magic)) != 0
+          || h->version != BLOB_VERSION
+          || h->size != len)
+        return false;
+    if (h->root == 0)
+        return true;
+
+    // Walk the tree with an explicit stack of (offset, limit) pairs.  Each
+    // node must lie before its parent, so the walk ends; and a tree has at
+    // most LEN / sizeof(BlobCmd) nodes, which bounds the work on a blob whose
+    // nodes share children.
+    size_t maxNodes = len / sizeof(BlobCmd), nNodes = 0;
+    size_t size = 64, top = 0;
+    uint32_t *stack = malloc (2 * size * sizeof(*stack));
+    bool ok = true;
+
+    stack[top++] = h->root;
+    stack[top++] = len;
+    while (ok && top > 0) {
+        uint32_t limit = stack[--top];
+        uint32_t off = stack[--top];
+        const BlobCmd *c = (const BlobCmd *) (b + off);
+
+        if (++nNodes > maxNodes || !inBounds (off, sizeof(*c), limit)) {
+            ok = false;
+            break;
+        }
+        ok = checkStrings (b, c->argv, c->argc, off)
+          && checkStrings (b, c->locVar, c->nLocal, off)
+          && checkStrings (b, c->locVal, c->nLocal, off)
+          && checkString (b, c->fromFile, off, true)
+          && (c->fromLen == 0
+                || (c->fromFile != 0
+                      && inBounds (c->fromFile, (size_t) c->fromLen + 1, off)
+                      && b[c->fromFile + c->fromLen] == '\0'))
+          && checkString (b, c->toFile, off, true)
+          && checkString (b, c->errFile, off, true);
+
+        if (top + 4 > 2 * size) {
+            size *= 2;
+            stack = realloc (stack, 2 * size * sizeof(*stack));
+        }
+        if (c->left) {
+            stack[top++] = c->left;
+            stack[top++] = off;
+        }
+        if (c->right) {
+            stack[top++] = c->right;
+            stack[top++] = off;
+        }
+    }
+
+    free (stack);
+    return ok;
+}
@@ -0,0 +1,91 @@
+// blob.h
+//
+// Header file for the binary form of a command tree: one contiguous,
+// relocatable block of memory (a "blob") that can be handed to another
+// process (e.g., through a pipe or shared memory) and read there in place,
+// without rebuilding the CMD structs.
+//
+// Every reference inside a blob is a 32-bit offset from the start of the blob
+// (0 means NULL, since the header is at offset 0), so a blob is limited to
+// 4 GB.  Integers are in the byte order of the machine that wrote the blob.
+// The layout is
+//
+//   BlobHeader                          at offset 0
+//   then for each node, in post order:
+//     its strings (NUL-terminated, each padded to a multiple of 4 bytes)
+//     its argv[], locVar[], and locVal[] (arrays of string offsets)
+//     its BlobCmd
+//
+// so that the children of a node (and everything else it refers to) always
+// come before it in the blob, and the root is the last node.
+
+#ifndef BLOB_INCLUDED
+#define BLOB_INCLUDED           // blob.h has been #include-d
+
+#include "parsley.h"
+
+#define BLOB_MAGIC   "PCMD"             // First four bytes of every blob
+#define BLOB_VERSION 1                  // Version of the layout above
+
+typedef struct blobHeader {
+    char magic[4];                      // BLOB_MAGIC
+    uint32_t version;                   // BLOB_VERSION
+    uint32_t size;                      // #bytes in blob, header included
+    uint32_t root;                      // Offset of root BlobCmd or 0
+} BlobHeader;
+
+// A CMD struct with offsets in place of pointers (see parsley.h for the
+// meaning of each field).  A HERE document is always stored as a string in
+// fromFile, even if it was spilled to a file (see fromFd); fromLen is its
+// length.
+typedef struct blobCmd {
+    int32_t type;
+    int32_t argc;
+    uint32_t argv;                      // Offset of argc string offsets
+    int32_t nLocal;
+    uint32_t locVar;                    // Offset of nLocal string offsets
+    uint32_t locVal;                    // Offset of nLocal string offsets
+    int32_t fromType;
+    uint32_t fromFile;                  // Offset of string or 0
+    uint32_t fromLen;                   // Length of HERE document
+    int32_t toType;
+    uint32_t toFile;                    // Offset of string or 0
+    int32_t errType;
+    uint32_t errFile;                   // Offset of string or 0
+    uint32_t left;                      // Offset of BlobCmd or 0
+    uint32_t right;                     // Offset of BlobCmd or 0
+} BlobCmd;
+
+
+// Return a blob for the tree rooted at C (allocated with malloc()) and set
+// *LEN to its length, or return NULL if the blob would exceed 4 GB
+void *cmdToBlob (CMD *c, size_t *len);
+
+
+// Return true if the LEN bytes at BLOB are a well-formed blob: the header
+// is valid, and every offset is in bounds, aligned, and points backward to a
+// NUL-terminated string or to a node (and each HERE document of fromLen
+// chars is followed by a NUL).  Use this on a blob from an untrusted
+// writer before calling the functions below, which do not check.
+bool blobCheck (const void *blob, size_t len);
+
+
+// Return the root node of BLOB, or NULL if the tree is empty
+const BlobCmd *blobRoot (const void *blob);
+
+
+// Return the node at offset OFF in BLOB (e.g., c->left), or NULL if OFF is 0
+const BlobCmd *blobNode (const void *blob, uint32_t off);
+
+
+// Return the string at offset OFF in BLOB (e.g., c->toFile), or NULL if OFF
+// is 0.  The string is not copied.
+const char *blobString (const void *blob, uint32_t off);
+
+
+// Return argv[I], locVar[I], or locVal[I] of node C in BLOB
+const char *blobArgv (const void *blob, const BlobCmd *c, int i);
+const char *blobLocVar (const void *blob, const BlobCmd *c, int i);
+const char *blobLocVal (const void *blob, const BlobCmd *c, int i);
+
+#endif
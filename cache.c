@@ -0,0 +1,190 @@
+// cache.c
+//
+// Parse cache; see cache.h.  Entries are chained in a hash table whose size
+// doubles when the table is full, and are also on a doubly-linked list from
+// most to least recently used, so a hit and an eviction each take O(1).
+
+#include "cache.h"
+#include "stats.h"
+
+#define CACHE_BUCKETS 256               // First #buckets; a power of 2
+
+typedef struct entry {
+    struct entry *chain;                // Next entry in the same bucket
+    struct entry *newer, *older;        // Neighbours on the LRU list
+    uint64_t hash;                      // Hash of key
+    size_t bytes;                       // #bytes charged to the cache
+    CMD *tree;                          // Tree for key (retained)
+    size_t len;                         // #chars in key
+    char key[];                         // Line, up to the end of any comment
+} Entry;
+
+struct cache {
+    Entry **bucket;                     // Hash table
+    size_t nBuckets;                    // #buckets (a power of 2)
+    Entry *newest, *oldest;             // Ends of the LRU list
+    size_t maxBytes;                    // Limit on stats.bytes
+    CacheStats stats;                   // Counters
+};
+
+
+Cache *mallocCache (size_t maxBytes)
+{
+    Cache *c = calloc (1, sizeof(*c));
+
+    c->nBuckets = CACHE_BUCKETS;
+    c->bucket = calloc (c->nBuckets, sizeof(*c->bucket));
+    STATS_ALLOC (sizeof(*c) + c->nBuckets * sizeof(*c->bucket));
+    c->maxBytes = maxBytes;
+    return c;
+}
+
+
+Cache *freeCache (Cache *c)
+{
+    if (!c)
+        return NULL;
+
+    for (Entry *e = c->newest, *next;  e;  e = next) {
+        next = e->older;
+        freeCMD (e->tree);
+        free (e);
+    }
+    free (c->bucket);
+    free (c);
+    return NULL;
+}
+
+
+uint64_t cacheHash (const char *key, size_t len)
+{
+    uint64_t h = 14695981039346656037ULL;       // 64-bit FNV-1a
+
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) key[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+
+// Remove entry E from the LRU list of C
+static void unlinkLRU (Cache *c, Entry *e)
+{
+    if (e->newer)
+        e->newer->older = e->older;
+    else
+        c->newest = e->older;
+    if (e->older)
+        e->older->newer = e->newer;
+    else
+        c->oldest = e->newer;
+}
+
+
+// Add entry E to C as the most recently used
+static void pushLRU (Cache *c, Entry *e)
+{
+    e->newer = NULL;
+    e->older = c->newest;
+    if (c->newest)
+        c->newest->newer = e;
+    else
+        c->oldest = e;
+    c->newest = e;
+}
+
+
+CMD *cacheLookup (Cache *c, const char *key, size_t len, uint64_t hash)
+{
+    for (Entry *e = c->bucket[hash & (c->nBuckets - 1)];  e;  e = e->chain) {
+        if (e->hash == hash && e->len == len && !memcmp (e->key, key, len)) {
+            c->stats.hits++;
+            unlinkLRU (c, e);
+            pushLRU (c, e);
+            return e->tree;
+        }
+    }
+    c->stats.misses++;
+    return NULL;
+}
+
+
+// Remove the least recently used entry from C and drop its tree
+static void evict (Cache *c)
+{
+    Entry *e = c->oldest;
+    Entry **p = &c->bucket[e->hash & (c->nBuckets - 1)];
+
+    while (*p != e)
+        p = &(*p)->chain;
+    *p = e->chain;
+    unlinkLRU (c, e);
+
+    c->stats.entries--;
+    c->stats.bytes -= e->bytes;
+    c->stats.evictions++;
+    freeCMD (e->tree);
+    free (e);
+}
+
+
+// Double the number of buckets in C
+static void grow (Cache *c)
+{
+    size_t n = 2 * c->nBuckets;
+    Entry **bucket = calloc (n, sizeof(*bucket));
+    STATS_ALLOC (n * sizeof(*bucket));
+
+    for (Entry *e = c->newest;  e;  e = e->older) {
+        Entry **b = &bucket[e->hash & (n - 1)];
+        e->chain = *b;
+        *b = e;
+    }
+    free (c->bucket);
+    c->bucket = bucket;
+    c->nBuckets = n;
+}
+
+
+void cacheInsert (Cache *c, const char *key, size_t len, uint64_t hash,
+                  CMD *tree)
+{
+    size_t bytes = sizeof(Entry) + len + arenaSize (tree->arena);
+    if (bytes > c->maxBytes)
+        return;
+
+    while (c->stats.bytes + bytes > c->maxBytes)
+        evict (c);
+    if (c->stats.entries >= c->nBuckets)
+        grow (c);
+
+    Entry *e = malloc (sizeof(*e) + len);
+    STATS_ALLOC (sizeof(*e) + len);
+    e->hash = hash;
+    e->bytes = bytes;
+    e->tree = tree;
+    arenaRetain (tree->arena);
+    e->len = len;
+    memcpy (e->key, key, len);
+
+    Entry **b = &c->bucket[hash & (c->nBuckets - 1)];
+    e->chain = *b;
+    *b = e;
+    pushLRU (c, e);
+
+    c->stats.entries++;
+    c->stats.bytes += bytes;
+}
+
+
+void cacheBypass (Cache *c)
+{
+    c->stats.bypasses++;
+}
+
+
+void cacheStats (Cache *c, CacheStats *s)
+{
+    *s = c->stats;
+}
@@ -0,0 +1,51 @@
+// cache.h
+//
+// Header file for the parse cache: a hash table of recently parsed command
+// lines and their trees, with least-recently-used eviction once the memory
+// it holds would exceed a limit.  A cached tree is shared: its arena has one
+// reference for the cache and one for each caller that has not yet called
+// freeCMD() on it (see arenaRetain()), so it must be treated as read-only.
+//
+// A cache is not thread-safe; in batch mode each worker has its own.
+
+#ifndef CACHE_INCLUDED
+#define CACHE_INCLUDED          // cache.h has been #include-d
+
+#include "parsley.h"
+
+typedef struct cache Cache;
+
+
+// Allocate, initialize, and return a pointer to an empty cache that holds at
+// most MAXBYTES bytes of keys and trees
+Cache *mallocCache (size_t maxBytes);
+
+
+// Free cache C (dropping its references to the trees in it) and return NULL
+Cache *freeCache (Cache *c);
+
+
+// Return the hash of the LEN chars at KEY
+uint64_t cacheHash (const char *key, size_t len);
+
+
+// Return the tree cached in C for the LEN chars at KEY, whose hash is HASH, or
+// NULL if there is none; count a hit or a miss.  The tree is not retained.
+CMD *cacheLookup (Cache *c, const char *key, size_t len, uint64_t hash);
+
+
+// Add TREE to C for the LEN chars at KEY, whose hash is HASH (which
+// cacheLookup() has just missed), retaining its arena and evicting the least
+// recently used trees to make room.  A tree too large for C is not added.
+void cacheInsert (Cache *c, const char *key, size_t len, uint64_t hash,
+                  CMD *tree);
+
+
+// Count a line that could not use C (e.g., one with a HERE document)
+void cacheBypass (Cache *c);
+
+
+// Set *S to the counters of C
+void cacheStats (Cache *c, CacheStats *s);
+
+#endif
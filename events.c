@@ -0,0 +1,376 @@
+// events.c
+//
+// Dump of commands from the callbacks of parseEvents(); see events.h.  Each
+// stage is formatted by wdumpNode() from a CMD struct on the C stack whose
+// strings are copies (NUL-terminated) in a buffer used as a stack, since the
+// stages of a [subcmd] come between its prefix and its redList.  The shape of
+// the tree, and so the depth of each node, comes from combining the nodes by
+// precedence as makeCMD() does, with parent links in place of CMD structs.
+
+#include "events.h"
+#include "stats.h"
+
+#define ARG   0                         // Kinds of word in a stage
+#define NAME  1
+#define VALUE 2
+
+typedef struct {
+    size_t off, len;                    // Text in EventDump.text
+    int parent;                         // Index of parent node, or -1
+    int depth;                          // Depth, or -1 until known
+} Line;
+
+typedef struct {
+    int op;                             // Operator (PIPE, ...), PAR_LEFT for
+                                        //   an open (, or NONE for operand
+    int node;                           // Its node, if any
+} Item;
+
+typedef struct {
+    int kind;                           // ARG, NAME, or VALUE
+    size_t off;                         // Offset of copy in EventDump.str
+} Word;
+
+typedef struct {
+    size_t str, word;                   // Marks in EventDump.str and .word
+    bool subcmd;                        // Is the stage a [subcmd]?
+    int child;                          // Node of its [command], or -1
+    int fromType, toType;               // Redirections, as in a CMD struct
+    size_t fromFile, toFile;            //   (the files are offsets in str)
+    const char *here;                   // HERE document, or NULL
+    int fromFd;
+    size_t fromLen;
+} Stage;
+
+struct eventDump {
+    Writer *out;                        // Where commands are dumped
+    Writer *text;                       // Lines of the command, sans depths
+    Line *line;                         // Nodes of the command in-order
+    size_t nLines, lineSize;
+    Item *item;                         // Operands and operators not yet
+    size_t nItems, itemSize;            //   combined
+    Stage *stage;                       // Stages begun and not yet ended
+    size_t nStages, stageSize;
+    Word *word;                         // Words of those stages, in order
+    size_t nWords, wordSize;
+    char *str;                          // Copies of strings of those stages
+    size_t strLen, strSize;
+    char **ptr;                         // Vectors for the CMD struct of a
+    size_t ptrSize;                     //   stage being dumped
+};
+
+
+// Make room for N elements of SIZE bytes in the array *A, which has room for
+// *MAX, by doubling it as often as needed
+static void grow (void *a, size_t *max, size_t n, size_t size)
+{
+    if (n <= *max)
+        return;
+    while (*max < n)
+        *max = *max ? 2 * *max : 16;
+    *(void **) a = realloc (*(void **) a, *max * size);
+    STATS_ALLOC (*max * size);
+}
+
+
+EventDump *mallocEventDump (Writer *w)
+{
+    EventDump *d = calloc (1, sizeof(*d));
+
+    d->out = w;
+    d->text = mallocWriter (-1);
+    return d;
+}
+
+
+EventDump *freeEventDump (EventDump *d)
+{
+    if (d) {
+        freeWriter (d->text);
+        free (d->line);
+        free (d->item);
+        free (d->stage);
+        free (d->word);
+        free (d->str);
+        free (d->ptr);
+        free (d);
+    }
+    return NULL;
+}
+
+
+// Return the offset in D->str of a NUL-terminated copy of the N chars at S
+static size_t copy (EventDump *d, const char *s, size_t n)
+{
+    size_t off = d->strLen;
+
+    grow (&d->str, &d->strSize, off + n + 1, 1);
+    memcpy (d->str + off, s, n);
+    d->str[off + n] = '\0';
+    d->strLen += n + 1;
+    return off;
+}
+
+
+// Add a word of kind KIND with the N chars at S to the current stage of D
+static void addWord (EventDump *d, int kind, const char *s, size_t n)
+{
+    grow (&d->word, &d->wordSize, d->nWords + 1, sizeof(*d->word));
+    d->word[d->nWords].kind = kind;
+    d->word[d->nWords].off = copy (d, s, n);
+    d->nWords++;
+}
+
+
+// Push an item for the operator OP (NONE for an operand) and NODE onto D
+static void pushItem (EventDump *d, int op, int node)
+{
+    grow (&d->item, &d->itemSize, d->nItems + 1, sizeof(*d->item));
+    d->item[d->nItems].op = op;
+    d->item[d->nItems].node = node;
+    d->nItems++;
+}
+
+
+// Append to D the line for the CMD struct C; return its node
+static int addLine (EventDump *d, CMD *c)
+{
+    int phase = statsPhase (PHASE_DUMP);
+
+    grow (&d->line, &d->lineSize, d->nLines + 1, sizeof(*d->line));
+    Line *l = &d->line[d->nLines];
+    l->off = d->text->len;
+    wdumpNode (d->text, c);
+    l->len = d->text->len - l->off;
+    l->parent = -1;
+    l->depth = -1;
+
+    statsPhase (phase);
+    return d->nLines++;
+}
+
+
+// Initialize the CMD struct *C as a node of type TYPE with no fields set
+static void initCMD (CMD *c, int type)
+{
+    static char *noArgs[] = {NULL};
+
+    *c = (CMD) {.type = type, .argv = noArgs, .fromType = NONE, .fromFd = -1,
+                .toType = NONE, .errType = NONE};
+}
+
+
+// Combine the operands on top of D with the operators between them, from
+// the top down, while the operator below the top operand binds at least as
+// tightly as PREC (> 0, so a ( stops it).  With PREC 1 (at the end of a
+// [command]), an operator on top is a ; or & that ends it and has only a
+// left child.
+static void reduce (EventDump *d, int prec)
+{
+    for ( ; ; ) {
+        Item *top = &d->item[d->nItems-1];
+
+        if (prec == 1 && d->nItems >= 2 && opPrec[top->op] > 0) {
+            d->line[top[-1].node].parent = top->node;
+            top[-1] = (Item) {NONE, top->node};
+            d->nItems--;
+        } else if (d->nItems >= 3 && opPrec[top[-1].op] >= prec) {
+            d->line[top[-2].node].parent = top[-1].node;
+            d->line[top->node].parent = top[-1].node;
+            top[-2] = (Item) {NONE, top[-1].node};
+            d->nItems -= 2;
+        } else {
+            break;
+        }
+    }
+}
+
+
+static void beginStage (void *ctx)
+{
+    EventDump *d = ctx;
+
+    grow (&d->stage, &d->stageSize, d->nStages + 1, sizeof(*d->stage));
+    d->stage[d->nStages++] = (Stage) {
+        .str = d->strLen, .word = d->nWords, .child = -1,
+        .fromType = NONE, .toType = NONE, .fromFd = -1};
+}
+
+
+static void local (void *ctx, const char *name, size_t nameLen,
+                              const char *value, size_t valueLen)
+{
+    addWord (ctx, NAME, name, nameLen);
+    addWord (ctx, VALUE, value, valueLen);
+}
+
+
+static void redirect (void *ctx, int type, const char *file, size_t len,
+                      int fd)
+{
+    EventDump *d = ctx;
+    Stage *s = &d->stage[d->nStages-1];
+
+    if (type == RED_IN_HERE) {
+        s->fromType = type;
+        s->here = file;
+        s->fromFd = fd;
+        s->fromLen = len;
+    } else if (type == RED_IN) {
+        s->fromType = type;
+        s->fromFile = copy (d, file, len);
+    } else {
+        s->toType = type;
+        s->toFile = copy (d, file, len);
+    }
+}
+
+
+static void arg (void *ctx, const char *text, size_t len)
+{
+    addWord (ctx, ARG, text, len);
+}
+
+
+static void openSubcmd (void *ctx)
+{
+    EventDump *d = ctx;
+
+    d->stage[d->nStages-1].subcmd = true;
+    pushItem (d, PAR_LEFT, -1);
+}
+
+
+static void closeSubcmd (void *ctx)
+{
+    EventDump *d = ctx;
+
+    reduce (d, 1);
+    d->stage[d->nStages-1].child = d->item[d->nItems-1].node;
+    d->nItems -= 2;                             // The command and the (
+}
+
+
+// Dump the current stage of D and pop it
+static void endStage (void *ctx)
+{
+    EventDump *d = ctx;
+    Stage *s = &d->stage[d->nStages-1];
+    size_t nWords = d->nWords - s->word;
+    CMD c;
+
+    initCMD (&c, s->subcmd ? SUBCMD : SIMPLE);
+
+    grow (&d->ptr, &d->ptrSize, nWords + 3, sizeof(*d->ptr));
+    char **argv = d->ptr;                       // Args, then names, then
+    for (size_t i = s->word; i < d->nWords; i++)        //   values
+        if (d->word[i].kind == ARG)
+            argv[c.argc++] = d->str + d->word[i].off;
+    argv[c.argc] = NULL;
+
+    char **locVar = argv + c.argc + 1;
+    for (size_t i = s->word; i < d->nWords; i++)
+        if (d->word[i].kind == NAME)
+            locVar[c.nLocal++] = d->str + d->word[i].off;
+    locVar[c.nLocal] = NULL;
+
+    char **locVal = locVar + c.nLocal + 1;
+    for (size_t i = s->word, n = 0; i < d->nWords; i++)
+        if (d->word[i].kind == VALUE)
+            locVal[n++] = d->str + d->word[i].off;
+    locVal[c.nLocal] = NULL;
+
+    if (!s->subcmd)
+        c.argv = argv;
+    if (c.nLocal > 0) {
+        c.locVar = locVar;
+        c.locVal = locVal;
+    }
+    c.fromType = s->fromType;
+    if (s->fromType == RED_IN)
+        c.fromFile = d->str + s->fromFile;
+    else if (s->fromType == RED_IN_HERE) {
+        c.fromFile = (char *) s->here;
+        c.fromFd = s->fromFd;
+        c.fromLen = s->fromLen;
+    }
+    c.toType = s->toType;
+    if (s->toType != NONE)
+        c.toFile = d->str + s->toFile;
+
+    int node = addLine (d, &c);
+    if (s->child >= 0)
+        d->line[s->child].parent = node;
+    pushItem (d, NONE, node);
+
+    d->strLen = s->str;                         // Pop the stage
+    d->nWords = s->word;
+    d->nStages--;
+}
+
+
+static void op (void *ctx, int type)
+{
+    EventDump *d = ctx;
+    CMD c;
+
+    reduce (d, opPrec[type]);
+    initCMD (&c, type);
+    pushItem (d, type, addLine (d, &c));
+}
+
+
+// Return the depth of node I of D, setting it and those of its ancestors
+// without recursion
+static int depthOf (EventDump *d, int i)
+{
+    int n = 0;                                  // #ancestors of unknown depth
+    int j;
+
+    for (j = i;  d->line[j].depth < 0;  j = d->line[j].parent) {
+        if (d->line[j].parent < 0) {            // The root
+            d->line[j].depth = 0;
+            break;
+        }
+        n++;
+    }
+    int depth = d->line[j].depth + n;
+    for (j = i;  n > 0;  j = d->line[j].parent, n--)
+        d->line[j].depth = depth--;
+    return d->line[i].depth;
+}
+
+
+// Write the lines of the command to the writer of D with their depths (if
+// OK), and start a new one
+static void endCommand (void *ctx, bool ok)
+{
+    EventDump *d = ctx;
+    int phase = statsPhase (PHASE_DUMP);
+
+    if (ok) {
+        reduce (d, 1);
+        for (size_t i = 0; i < d->nLines; i++) {
+            wrLit (d->out, "CMD (Depth = ");
+            wrLong (d->out, depthOf (d, i));
+            wrLit (d->out, "):  ");
+            wrBytes (d->out, d->text->buf + d->line[i].off, d->line[i].len);
+        }
+    }
+    d->text->len = 0;
+    d->nLines = d->nItems = d->nStages = d->nWords = d->strLen = 0;
+    statsPhase (phase);
+}
+
+
+const ParseEvents dumpEvents = {
+    .beginStage  = beginStage,
+    .local       = local,
+    .redirect    = redirect,
+    .arg         = arg,
+    .openSubcmd  = openSubcmd,
+    .closeSubcmd = closeSubcmd,
+    .endStage    = endStage,
+    .op          = op,
+    .endCommand  = endCommand,
+};
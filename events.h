@@ -0,0 +1,32 @@
+// events.h
+//
+// Header file for a consumer of the callbacks of parseEvents() that prints
+// each command just as dumpTree() prints its tree, without building one.
+// In the tree the stages and operators appear in-order in the same order as
+// their tokens, so each line can be formatted as soon as its stage or
+// operator has been seen.  But the depth of a node (e.g., of the first stage
+// of a long pipeline) is not known until the command ends, so the lines of
+// a command are held until then.  All storage is kept from command to
+// command, so once one command as large has been seen, none is allocated.
+
+#ifndef EVENTS_INCLUDED
+#define EVENTS_INCLUDED         // events.h has been #include-d
+
+#include "parsley.h"
+
+typedef struct eventDump EventDump;
+
+
+// The callbacks; their context is an EventDump
+extern const ParseEvents dumpEvents;
+
+
+// Allocate, initialize, and return a pointer to a consumer that appends the
+// dump of each valid command to W (and nothing for an invalid one)
+EventDump *mallocEventDump (Writer *w);
+
+
+// Free the consumer D (but not its writer) and return NULL
+EventDump *freeEventDump (EventDump *d);
+
+#endif
@@ -0,0 +1,205 @@
+// flat.c
+//
+// Flat form of a command tree; see flat.h.  Both conversions work top down
+// with an explicit stack (see walk.h) of the nodes still to be converted,
+// each with where its result goes.
+
+#include "flat.h"
+#include "walk.h"
+
+#define LEFT  0                         // Sides of a CMD struct (see attach())
+#define RIGHT 1
+
+
+// Drop the reference to the arena A held by another arena; called when that
+// arena is freed
+static void release (void *a)
+{
+    freeArena (a);
+}
+
+
+// Return the chain that a node of type TYPE is a link of: PIPE, SEP_AND (&&
+// and ||), or SEP_END (; and &); or NONE for a [stage]
+static int chainOf (int type)
+{
+    switch (type) {
+        case PIPE:                      return PIPE;
+        case SEP_AND: case SEP_OR:      return SEP_AND;
+        case SEP_END: case SEP_BG:      return SEP_END;
+        default:                        return NONE;
+    }
+}
+
+
+// Push onto STACK the subtree C, to be converted into the flat node F
+static void pushFlat (Walk *stack, CMD *c, Flat *f)
+{
+    walkPush (stack, c, 0);
+    walkTop (stack)->p = f;
+}
+
+
+// Fill in the flat node F for the subtree C from arena A, and push the
+// children of F onto STACK
+static void flatNode (Arena *a, Flat *f, CMD *c, Walk *stack)
+{
+    int chain = chainOf (c->type);
+    int end = NONE;
+
+    f->n = 0;
+    f->kid = NULL;
+    f->op = NULL;
+    f->cmd = NULL;
+    f->sub = NULL;
+    f->arena = a;
+
+    if (chain == SEP_END && c->right == NULL) { // [sequence] ; or &, even if
+        end = c->type;                          //   the [sequence] is just
+        c = c->left;                            //   one [and-or]
+    } else if (chain == NONE) {                 // [stage]
+        f->type = c->type;
+        f->cmd = c;
+        if (c->type == SUBCMD && c->left) {
+            f->sub = arenaAlloc (a, sizeof(*f->sub));
+            pushFlat (stack, c->left, f->sub);
+        }
+        return;
+    }
+
+    int n = 1;                                  // Links down the left spine
+    for (CMD *t = c;  chainOf (t->type) == chain && t->right;  t = t->left)
+        n++;
+
+    f->type = (end != NONE) ? SEP_END : chain;
+    f->n = n;
+    f->kid = arenaAlloc (a, n * sizeof(*f->kid));
+    f->op = arenaAlloc (a, n * sizeof(*f->op));
+    f->op[n-1] = end;
+    for (int i = n-1; i > 0; i--, c = c->left) {
+        f->op[i-1] = c->type;
+        pushFlat (stack, c->right, &f->kid[i]);
+    }
+    pushFlat (stack, c, &f->kid[0]);
+}
+
+
+Flat *cmdToFlat (CMD *c)
+{
+    if (!c)
+        return NULL;
+
+    Arena *a = mallocArena();
+    if (c->arena)                               // Keep the stages alive
+        arenaDefer (a, release, arenaRetain (c->arena));
+
+    Flat *root = arenaAlloc (a, sizeof(*root));
+    Walk stack;
+
+    walkInit (&stack);
+    pushFlat (&stack, c, root);
+    while (stack.len > 0) {
+        WalkFrame f = walkPop (&stack);
+        flatNode (a, f.p, f.cmd, &stack);
+    }
+    walkFree (&stack);
+    return root;
+}
+
+
+// Return a CMD struct of type TYPE with no children from arena A for an
+// operator
+static CMD *opNode (Arena *a, int type)
+{
+    static char *noArgs[] = {NULL};
+    CMD *c = arenaAlloc (a, sizeof(*c));
+
+    *c = (CMD) {.type = type, .argv = noArgs, .fromType = NONE, .fromFd = -1,
+                .toType = NONE, .errType = NONE, .arena = a};
+    return c;
+}
+
+
+// Make C the child SIDE (LEFT or RIGHT) of PARENT, or the root *ROOT if
+// PARENT is NULL
+static void attach (CMD **root, CMD *parent, int side, CMD *c)
+{
+    if (!parent)
+        *root = c;
+    else if (side == LEFT)
+        parent->left = c;
+    else
+        parent->right = c;
+}
+
+
+// Push onto STACK the flat node F, whose tree is to be the child SIDE of
+// PARENT (see attach())
+static void pushCmd (Walk *stack, CMD *parent, int side, Flat *f)
+{
+    walkPush (stack, parent, side);
+    walkTop (stack)->p = f;
+}
+
+
+// Make the CMD structs for the flat node F from arena A, attach them as the
+// child SIDE of PARENT (see attach()), and push the children of F onto STACK
+static void cmdNode (Arena *a, Flat *f, CMD **root, CMD *parent, int side,
+                     Walk *stack)
+{
+    if (f->n == 0) {                            // [stage]: copy its struct
+        CMD *c = arenaAlloc (a, sizeof(*c));
+        *c = *f->cmd;
+        c->left = c->right = NULL;
+        c->arena = a;
+        attach (root, parent, side, c);
+        if (f->sub)
+            pushCmd (stack, c, LEFT, f->sub);
+        return;
+    }
+
+    if (f->op[f->n-1] != NONE) {                // [sequence] ; or &
+        CMD *c = opNode (a, f->op[f->n-1]);
+        attach (root, parent, side, c);
+        parent = c;
+        side = LEFT;
+    }
+    for (int i = f->n-1; i > 0; i--) {          // Links, from the top down
+        CMD *c = opNode (a, f->op[i-1]);
+        attach (root, parent, side, c);
+        pushCmd (stack, c, RIGHT, &f->kid[i]);
+        parent = c;
+        side = LEFT;
+    }
+    pushCmd (stack, parent, side, &f->kid[0]);
+}
+
+
+CMD *flatToCmd (Flat *f)
+{
+    if (!f)
+        return NULL;
+
+    Arena *a = mallocArena();                   // Keep the stages alive
+    arenaDefer (a, release, arenaRetain (f->arena));
+
+    CMD *root = NULL;
+    Walk stack;
+
+    walkInit (&stack);
+    pushCmd (&stack, NULL, LEFT, f);
+    while (stack.len > 0) {
+        WalkFrame w = walkPop (&stack);
+        cmdNode (a, w.p, &root, w.cmd, w.n, &stack);
+    }
+    walkFree (&stack);
+    return root;
+}
+
+
+Flat *freeFlat (Flat *f)
+{
+    if (f)
+        freeArena (f->arena);
+    return NULL;
+}
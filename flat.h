@@ -0,0 +1,57 @@
+// flat.h
+//
+// Header file for the flat form of a command tree, in which each chain of
+// binary nodes becomes one node with an array of children: a [pipeline] of N
+// stages is one PIPE node with N children instead of N-1 nested PIPE nodes,
+// and likewise a run of && and || (an [and-or]) and a run of ; and & (a
+// [sequence]).  The children of a node are stored contiguously, so the number
+// of stages in a pipeline is just its n, and a walk over them is a scan of an
+// array rather than a chase down the left spine.
+//
+// A [stage] is not copied: its node points at the SIMPLE or SUBCMD struct of
+// the tree that it was made from (see cmdToFlat()).  The flat form of a tree
+// comes from one arena of its own, and holds a reference to the arena of that
+// tree, so either can be freed first.  cmdToFlat() and flatToCmd() convert
+// between the two forms without recursion, and flatToCmd (cmdToFlat (C))
+// dumps just as C does.
+
+#ifndef FLAT_INCLUDED
+#define FLAT_INCLUDED           // flat.h has been #include-d
+
+#include "parsley.h"
+
+typedef struct flat {
+    int type;                           // SIMPLE or SUBCMD for a [stage];
+                                        //   PIPE for a [pipeline], SEP_AND
+                                        //   for an [and-or], SEP_END for a
+                                        //   [sequence]
+    int n;                              // #children (0 for a [stage])
+    struct flat *kid;                   // The n children, in order
+    int *op;                            // op[i] (PIPE, SEP_AND, SEP_OR,
+                                        //   SEP_END, or SEP_BG) joins kid[i]
+                                        //   and kid[i+1]; op[n-1] is NONE,
+                                        //   or ; (= SEP_END) or & (= SEP_BG)
+                                        //   if that ends a [command]
+    CMD *cmd;                           // For a [stage], its struct (argv,
+                                        //   locals, redirection; the left
+                                        //   child of a SUBCMD is not used)
+    struct flat *sub;                   // For a SUBCMD, the [command] in the
+                                        //   ( ), or NULL
+    Arena *arena;                       // Arena holding the whole flat form
+} Flat;
+
+
+// Return the flat form of the tree rooted at C, or NULL if C is NULL.  If C
+// was not made by parse() (see CMD.arena), it must outlive the flat form.
+Flat *cmdToFlat (CMD *c);
+
+
+// Return a tree of CMD structs (the classic binary shape) for the flat form
+// F, or NULL if F is NULL; free it with freeCMD()
+CMD *flatToCmd (Flat *f);
+
+
+// Free the flat form F (which must be the root) and return NULL
+Flat *freeFlat (Flat *f);
+
+#endif
@@ -0,0 +1,198 @@
+// json.c
+//
+// JSON form of a command tree; see json.h.
+
+#include "json.h"
+#include "walk.h"
+#include <unistd.h>
+
+// Name of each node type and text of each redirection, indexed by type
+static const char *typeName[] = {
+    [SIMPLE] = "SIMPLE", [SUBCMD] = "SUBCMD", [PIPE] = "PIPE",
+    [SEP_AND] = "SEP_AND", [SEP_OR] = "SEP_OR",
+    [SEP_END] = "SEP_END", [SEP_BG] = "SEP_BG",
+};
+static const char *redName[] = {
+    [RED_IN] = "<", [RED_IN_HERE] = "<<",
+    [RED_OUT] = ">", [RED_OUT_APP] = ">>", [RED_OUT_ERR] = "&>",
+    [RED_ERR] = "2>", [RED_ERR_APP] = "2>>",
+};
+
+#define NAME(table,i) ((i) >= 0 && (size_t) (i) < sizeof(table)/sizeof(*table) \
+                         && table[i] ? table[i] : "INVALID")
+
+// Escape for each char that may not appear as is in a JSON string: 'u' for
+// \u00XX, the letter for a two-char escape, and 0 for no escape needed
+static const char escape[256] = {
+    ['\b'] = 'b', ['\t'] = 't', ['\n'] = 'n', ['\f'] = 'f', ['\r'] = 'r',
+    [0x00] = 'u', [0x01] = 'u', [0x02] = 'u', [0x03] = 'u', [0x04] = 'u',
+    [0x05] = 'u', [0x06] = 'u', [0x07] = 'u', [0x0b] = 'u', [0x0e] = 'u',
+    [0x0f] = 'u', [0x10] = 'u', [0x11] = 'u', [0x12] = 'u', [0x13] = 'u',
+    [0x14] = 'u', [0x15] = 'u', [0x16] = 'u', [0x17] = 'u', [0x18] = 'u',
+    [0x19] = 'u', [0x1a] = 'u', [0x1b] = 'u', [0x1c] = 'u', [0x1d] = 'u',
+    [0x1e] = 'u', [0x1f] = 'u', ['"'] = '"', ['\\'] = '\\',
+};
+
+
+// Append the N chars at S to W, escaped for a JSON string (but without the
+// quotes); runs of chars that need no escape are copied at once
+static void jsonChars (Writer *w, const char *s, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    const char *run = s, *end = s + n;
+
+    for ( ; s < end; s++) {
+        char e = escape[(unsigned char) *s];
+        if (!e)
+            continue;
+
+        wrBytes (w, run, s - run);
+        wrChar (w, '\\');
+        wrChar (w, e);
+        if (e == 'u') {
+            wrLit (w, "00");
+            wrChar (w, hex[(unsigned char) *s >> 4]);
+            wrChar (w, hex[*s & 0xf]);
+        }
+        run = s+1;
+    }
+    wrBytes (w, run, end - run);
+}
+
+
+// Append the string S to W as a JSON string
+static void jsonString (Writer *w, const char *s)
+{
+    wrChar (w, '"');
+    jsonChars (w, s, strlen (s));
+    wrChar (w, '"');
+}
+
+
+// Append the LEN chars of the HERE document in the file FD (see fromFd) to W
+// as a JSON string, reading it back a block at a time
+static void jsonHereFd (Writer *w, int fd, size_t len)
+{
+    char buf[64 * 1024];
+    size_t pos = 0;                     // Offset of buf in the file
+
+    wrChar (w, '"');
+    while (pos < len) {
+        ssize_t n = pread (fd, buf, sizeof(buf), pos);
+        if (n <= 0)
+            break;
+        jsonChars (w, buf, n);
+        pos += n;
+    }
+    wrChar (w, '"');
+}
+
+
+// Append the member "KEY": {"op": ..., "file": FILE} for a redirection of
+// type TYPE to W (nothing if TYPE is NONE); FILE may be NULL
+static void jsonRedirect (Writer *w, const char *key, int type,
+                          const char *file)
+{
+    if (type == NONE)
+        return;
+
+    wrLit (w, ",\"");
+    wrStr (w, key);
+    wrLit (w, "\":{\"op\":\"");
+    wrStr (w, NAME (redName, type));
+    wrChar (w, '"');
+    if (file) {
+        wrLit (w, ",\"file\":");
+        jsonString (w, file);
+    }
+    wrChar (w, '}');
+}
+
+
+// Append the members of the node C other than "left" and "right" to W, after
+// the { that opens it
+static void jsonNode (Writer *w, CMD *c)
+{
+    wrLit (w, "\"type\":\"");
+    wrStr (w, NAME (typeName, c->type));
+    wrChar (w, '"');
+
+    if (c->type == SIMPLE) {
+        wrLit (w, ",\"argv\":[");
+        for (int i = 0; i < c->argc; i++) {
+            if (i > 0)
+                wrChar (w, ',');
+            jsonString (w, c->argv[i]);
+        }
+        wrChar (w, ']');
+    }
+
+    if (c->nLocal > 0) {
+        wrLit (w, ",\"locals\":[");
+        for (int i = 0; i < c->nLocal; i++) {
+            if (i > 0)
+                wrChar (w, ',');
+            wrLit (w, "{\"name\":");
+            jsonString (w, c->locVar[i]);
+            wrLit (w, ",\"value\":");
+            jsonString (w, c->locVal[i]);
+            wrChar (w, '}');
+        }
+        wrChar (w, ']');
+    }
+
+    if (c->fromType == RED_IN_HERE) {
+        wrLit (w, ",\"from\":{\"op\":\"<<\",\"here\":");
+        if (c->fromFile == NULL && c->fromFd >= 0)
+            jsonHereFd (w, c->fromFd, c->fromLen);
+        else
+            jsonString (w, c->fromFile ? c->fromFile : "");
+        wrChar (w, '}');
+    } else {
+        jsonRedirect (w, "from", c->fromType, c->fromFile);
+    }
+    jsonRedirect (w, "to", c->toType, c->toFile);
+    jsonRedirect (w, "err", c->errType, c->errFile);
+}
+
+
+// How far the object for a node on the stack in jsonTree() has got
+#define OPEN  0                         // Nothing written yet
+#define LEFT  1                         // Members and "left" written
+#define RIGHT 2                         // "right" written too
+
+void jsonTree (Writer *w, CMD *c)
+{
+    if (!c)
+        return;
+
+    Walk stack;                                 // Nodes whose objects are
+    walkInit (&stack);                          //   open (see walk.h)
+    walkPush (&stack, c, OPEN);
+
+    while (stack.len > 0) {
+        WalkFrame *f = walkTop (&stack);
+        c = f->cmd;
+
+        if (f->n == OPEN) {
+            f->n = LEFT;
+            wrChar (w, '{');
+            jsonNode (w, c);
+            if (c->left) {
+                wrLit (w, ",\"left\":");
+                walkPush (&stack, c->left, OPEN);
+            }
+        } else if (f->n == LEFT) {
+            f->n = RIGHT;
+            if (c->right) {
+                wrLit (w, ",\"right\":");
+                walkPush (&stack, c->right, OPEN);
+            }
+        } else {
+            wrChar (w, '}');
+            walkPop (&stack);
+        }
+    }
+    walkFree (&stack);
+    wrChar (w, '\n');
+}
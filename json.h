@@ -0,0 +1,30 @@
+// json.h
+//
+// Header file for the JSON form of a command tree, written as a stream
+// straight into a Writer (no intermediate document is built).
+//
+// Each node is an object with the members
+//
+//   "type"    "SIMPLE", "SUBCMD", "PIPE", "SEP_AND", "SEP_OR", "SEP_END", or
+//             "SEP_BG" (the names that dumpTree() prints)
+//   "argv"    array of strings                        (SIMPLE only)
+//   "locals"  array of {"name": string, "value": string}
+//   "from"    {"op": "<", "file": string} or {"op": "<<", "here": string}
+//   "to"      {"op": ">" / ">>" / "&>", "file": string}
+//   "err"     {"op": "2>" / "2>>", "file": string} or {"op": "&>"}
+//   "left"    node
+//   "right"   node
+//
+// where members that would be empty or NULL are omitted.  Strings are
+// escaped as JSON requires; other bytes (e.g., UTF-8) are copied as is.
+
+#ifndef JSON_INCLUDED
+#define JSON_INCLUDED           // json.h has been #include-d
+
+#include "parsley.h"
+
+// Append the tree rooted at C to W as one line of JSON (an object followed
+// by a newline); append nothing if C is NULL
+void jsonTree (Writer *w, CMD *c);
+
+#endif
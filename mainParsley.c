@@ -4,243 +4,402 @@
 // command structures, and dumps the command structures to stdout.
 //
 // Bash version based on expression tree
+//
+// With FILE, reads the commands from FILE instead of stdin; a regular file is
+// mapped into memory and its lines are parsed in place, without copying.
+//
+// With -j THREADS, parses the lines of FILE (or stdin) in batch mode on
+// THREADS worker threads (one per CPU if THREADS is 0); see batch.h.
+//
+// With --here-max=BYTES, HERE documents longer than BYTES (which may end in
+// k, M, or G) are kept in an anonymous file instead of in memory.
+//
+// With --json, writes each command structure as one line of JSON (see
+// json.h) instead of as a tree, and writes no prompts.
+//
+// With --cache=BYTES, keeps up to BYTES of recently parsed lines and their
+// trees so that repeated lines are not parsed again (see parserSetCache()),
+// and writes the cache counters to stderr at the end.
+//
+// With --continue, a command may go on to the next line when its line ends
+// with a backslash or leaves a ( open (see parserSetContinue()); the prompt
+// for such a line is "> ".  Not allowed with -j.
+//
+// With --stats, writes to stderr at exit the time spent and the allocations
+// made in each phase (tokenizing, building trees, reading HERE documents,
+// dumping, and freeing trees) and the distribution of the time taken to parse
+// a line (see stats.h).
+//
+// With --events, recognizes each command with parseEvents() and dumps it as
+// it is recognized (see events.h) instead of building its tree; the output
+// is the same.  With --check, just checks the syntax of each command without
+// building a tree or writing anything but the error messages, and exits with
+// status 1 if any command has an error.  Neither is allowed with -j, --json,
+// --cache, or --continue.
+//
+// With --tokens, just splits each line into tokens with lex() (e.g., for a
+// syntax highlighter) and writes one line of NAME START END triples for it,
+// where NAME is that of its type (TEXT, RED_IN, ..., PAR_RIGHT) and START and
+// END are the offsets of its first char and just past its last in the line;
+// writes nothing else.  Not allowed with the options above.
 
 #include "parsley.h"
-
-int main()
+#include "batch.h"
+#include "json.h"
+#include "stats.h"
+#include "events.h"
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define USAGE "usage: parsley [--json] [--here-max=BYTES] [--cache=BYTES] " \
+              "[--continue] [--stats] [--events | --check | --tokens] " \
+              "[-j THREADS] [FILE]\n"
+
+static bool json;                               // Write JSON (--json)?
+static Stats *stats;                            // Counters (--stats) or NULL
+static uint64_t start;                          //   and when counting began
+static EventDump *events;                       // Dump from events (--events)
+static bool check;                              // Only check syntax (--check)?
+static bool invalid;                            //   and was there an error?
+static bool tokens;                             // Only write tokens (--tokens)?
+static Lexeme *lexeme;                          //   Tokens of the line
+static int nLexemes;                            //   #tokens it has room for
+
+// Names of the token types (for --tokens)
+static const char *tokenName[PAR_RIGHT+1] = {
+    [TEXT] = "TEXT", [RED_IN] = "RED_IN", [RED_IN_HERE] = "RED_IN_HERE",
+    [RED_OUT] = "RED_OUT", [RED_OUT_APP] = "RED_OUT_APP",
+    [RED_OUT_ERR] = "RED_OUT_ERR", [RED_ERR] = "RED_ERR",
+    [RED_ERR_APP] = "RED_ERR_APP", [PIPE] = "PIPE", [SEP_AND] = "SEP_AND",
+    [SEP_OR] = "SEP_OR", [SEP_END] = "SEP_END", [SEP_BG] = "SEP_BG",
+    [PAR_LEFT] = "PAR_LEFT", [PAR_RIGHT] = "PAR_RIGHT",
+};
+
+
+// Write the --stats report to stderr and free the counters; called at exit,
+// after the output has been flushed
+static void reportStats (void)
 {
-    int nCmd = 1;                   // Command number
-    CMD *cmd;                       // Parsed command
+    statsStop();
+    statsReport (stats, (statsNow() - start) / 1e9, stderr);
+    stats = freeStats (stats);
+}
 
-    char *line = NULL;                          // Space for line read
-    size_t nLine = 0;                           // #chars allocated
-    for ( ; ; ) {
-        printf ("(%d)$ ", nCmd);                // Prompt for command
-        fflush (stdout);
+// Return the size in bytes given by S (digits with an optional suffix k, M,
+// or G), or (size_t) -1 if S is not a valid size
+static size_t parseSize (const char *s)
+{
+    char *end;
+    unsigned long long n = strtoull (s, &end, 10);
+
+    if (end == s || *s == '-')
+        return (size_t) -1;
+    switch (*end) {
+        case 'G': case 'g': n <<= 10;       // Fall through
+        case 'M': case 'm': n <<= 10;       // Fall through
+        case 'K': case 'k': n <<= 10; end++;
+    }
+    return *end ? (size_t) -1 : (size_t) n;
+}
 
-        if (getline (&line,&nLine, stdin) <= 0) // Read line
-            break;                              //   Break on end of file
 
-        if ((cmd = parse (line)) != NULL) {     // Parsed command?
-            dumpTree (cmd, 0);                  //   Dump CMD as tree to stdout
-            cmd = freeCMD (cmd);                //   Free associated storage
-            nCmd++;                             // Adjust prompt
-        }
+// Write the prompt for command number NCMD, or for the rest of the
+// incomplete command held by parser context P, to W (unless writing JSON)
+static void prompt (Writer *w, Parser *p, int nCmd)
+{
+    if (json || check || tokens)
+        return;
+    if (parserPending (p)) {
+        wrLit (w, "> ");
+        return;
     }
-
-    printf ("\n");                              // Add final newline
-    free (line);
-    return EXIT_SUCCESS;
+    wrChar (w, '(');
+    wrLong (w, nCmd);
+    wrLit (w, ")$ ");
 }
 
 
-// Allocate, initialize, and return a pointer to a command structure of type
-// TYPE with left child LEFT and right child RIGHT
-CMD *mallocCMD (int type, CMD *left, CMD *right)
+// Write the command structure CMD to W as a tree or as JSON
+static void dump (Writer *w, CMD *cmd)
 {
-    CMD *new = malloc(sizeof(*new));
-
-    new->type     = type;
-    new->argc     = 0;
-    new->argv     = malloc (sizeof(char *));
-    new->argv[0]  = NULL;
-    new->nLocal   = 0;
-    new->locVar   = NULL;
-    new->locVal   = NULL;
-    new->fromType = NONE;
-    new->fromFile = NULL;
-    new->toType   = NONE;
-    new->toFile   = NULL;
-    new->errType  = NONE;
-    new->errFile  = NULL;
-    new->left     = left;
-    new->right    = right;
-
-    return new;
+    int phase = statsPhase (PHASE_DUMP);
+    if (json)
+        jsonTree (w, cmd);
+    else
+        wdumpTree (w, cmd, 0);
+    statsPhase (phase);
 }
 
 
-// Free tree of commands rooted at *C and return NULL
-CMD *freeCMD (CMD *c)
+// Split the LEN chars at LINE into tokens with parser context P and write
+// them to W as one line
+static void writeTokens (Parser *p, char *line, size_t len, Writer *w)
 {
-    if (!c)
-        return NULL;
+    int n = lex (p, line, len, lexeme, nLexemes);
 
-    for (int i = 0; i < c->nLocal; i++) {
-        free (c->locVar[i]);
-        free (c->locVal[i]);
+    if (n > nLexemes) {                         // Grow and lex again
+        while (nLexemes < n)
+            nLexemes = nLexemes ? 2 * nLexemes : 64;
+        lexeme = realloc (lexeme, nLexemes * sizeof(*lexeme));
+        n = lex (p, line, len, lexeme, nLexemes);
     }
-    free (c->locVar);
-    free (c->locVal);
-
-    for (char **p = c->argv;  *p;  p++)
-        free (*p);
-    free (c->argv);
 
-    free (c->fromFile);
-    free (c->toFile);
-    free (c->errFile);
-
-    c->left = freeCMD (c->left);
-    c->right = freeCMD (c->right);
-
-    free (c);
-    return NULL;
+    int phase = statsPhase (PHASE_DUMP);
+    for (int i = 0; i < n; i++) {
+        if (i > 0)
+            wrChar (w, ' ');
+        wrStr (w, tokenName[lexeme[i].type]);
+        wrChar (w, ' ');
+        wrLong (w, lexeme[i].start);
+        wrChar (w, ' ');
+        wrLong (w, lexeme[i].end);
+    }
+    wrChar (w, '\n');
+    statsPhase (phase);
 }
 
 
-///////////////////////////////////////////////////////////////////////////////
-// Dump CMD structure in tree format
-
-// Print arguments in command data structure rooted at *C
-void dumpArgs (CMD *c)
+// Parse the LEN chars at LINE with parser context P and dump the command
+// structure to W (or check or dump it from events, or write its tokens);
+// return true if LINE held a command
+static bool parseOne (Parser *p, char *line, size_t len, Writer *w)
 {
-    if (c->argc < 0)
-        fprintf (stdout, "  ARGC < 0");
-    else if (c->argv == NULL)
-        fprintf (stdout, "  ARGV = NULL");
-    else if (c->argv[c->argc] != NULL)
-        fprintf (stdout, "  ARGV[ARGC] != NULL");
-    else {
-////    fprintf (stdout, ",  argc = %d", c->argc);
-        for (char **q = c->argv;  *q;  q++)
-            fprintf (stdout, ",  argv[%ld] = %s", q-(c->argv), *q);
+    if (tokens) {
+        writeTokens (p, line, len, w);
+        return false;
+    }
+    if (check || events) {
+        int status = parseEvents (p, line, len, events ? &dumpEvents : NULL,
+                                  events);
+        if (status < 0)
+            invalid = true;
+        return status > 0;
     }
+
+    CMD *cmd = parse_n (p, line, len);
+    if (!cmd)
+        return false;
+    dump (w, cmd);                              // Dump CMD to W
+    cmd = freeCMD (cmd);                        // Free associated storage
+    return true;
 }
 
 
-// Print input/output redirections and local variables in command data
-// structure rooted at *C
-void dumpRedirect (CMD *c)
+// Parse the lines read from IN with parser context P, prompting for each
+// and dumping the command structures to W, which is flushed before each line
+// is read so that the prompt appears
+static int parseStream (Parser *p, FILE *in, Writer *w)
 {
-    if (c->fromType == NONE && c->fromFile == NULL)
-        ;
-    else if (c->fromType == RED_IN && c->fromFile != NULL)
-        fprintf (stdout, "  <%s", c->fromFile);
-    else if (c->fromType == RED_IN_HERE && c->fromFile != NULL)
-        fprintf (stdout, "  <<HERE");
-    else
-        fprintf (stdout, "  ILLEGAL INPUT REDIRECTION");
-
-    if (c->toType == NONE && c->toFile == NULL)
-        ;
-    else if (c->toType == RED_OUT && c->toFile != NULL)
-        fprintf (stdout, "  >%s", c->toFile);
-    else if (c->toType == RED_OUT_APP && c->toFile != NULL)
-        fprintf (stdout, "  >>%s", c->toFile);
-    else if (c->toType == RED_OUT_ERR && c->toFile != NULL)
-        fprintf (stdout, "  &>%s", c->toFile);
-    else
-        fprintf (stdout, "  ILLEGAL OUTPUT REDIRECTION");
-
-    if (c->errType == NONE && c->errFile == NULL)
-        ;
-    else if (c->errType == RED_ERR && c->errFile != NULL)
-        fprintf (stdout, "  2>%s", c->errFile);
-    else if (c->errType == RED_ERR_APP && c->errFile != NULL)
-        fprintf (stdout, "  2>>%s", c->errFile);
-    else if (c->errType == RED_OUT_ERR && c->errFile == NULL)
-        fprintf (stdout, "  &>%s", c->toFile);
-    else
-        fprintf (stdout, "  ILLEGAL ERROR REDIRECTION");
-
-    if (c->nLocal < 0) {
-        fprintf (stdout, "  INVALID NLOCAL");
-    } else if (c->nLocal == 0) {
-        ;
-    } else if (c->locVar == NULL || c->locVal == NULL) {
-        fprintf (stdout, "  INVALID LOCVAL or LOCVAR");
-    } else {
-        fprintf (stdout, "\n         LOCAL: ");
-        for (int i = 0; i < c->nLocal; i++)
-            if (strchr (c->locVal[i], '='))
-                fprintf (stdout, "%s = %s, ", c->locVar[i], c->locVal[i]);
-            else
-                fprintf (stdout, "%s=%s, ", c->locVar[i], c->locVal[i]);
-    }
-
-    if (c->fromType == RED_IN_HERE) {
-        if (c->fromFile == NULL) {
-            fprintf (stdout, "  INVALID FROMFILE FOR RED_IN_HERE");
-        } else {
-            fprintf (stdout, "\n         HERE:  ");
-            for (char *s = c->fromFile; *s; s++) {
-                if (*s != '\n')
-                    fputc (*s, stdout);
-                else if (s[1])
-                    fprintf (stdout, "\n         HERE:  ");
-                else
-                    fprintf (stdout, "<newline>");
-            }
-        }
+    int nCmd = 1;                   // Command number
+    CMD *cmd;                       // Parsed command
+
+    parserSetInput (p, in);
+
+    char *line = NULL;                          // Space for line read
+    size_t nLine = 0;                           // #chars allocated
+    for ( ; ; ) {
+        prompt (w, p, nCmd);                       // Prompt for command
+        flushWriter (w);
+
+        if (getline (&line,&nLine, in) <= 0)    // Read line
+            break;                              //   Break on end of file
+
+        if (parseOne (p, line, strlen (line), w))   // Parsed command?
+            nCmd++;                             // Adjust prompt
+    }
+
+    if ((cmd = parserFinish (p)) != NULL) {     // Command left incomplete
+        dump (w, cmd);                          //   at end of file
+        cmd = freeCMD (cmd);
     }
+    if (!json && !check && !tokens)
+        wrChar (w, '\n');                       // Add final newline
+    free (line);
+    return EXIT_SUCCESS;
 }
 
 
-// Print in in-order command data structure rooted at *C at depth LEVEL
-void dumpTree (CMD *c, int level)
+// Same as parseStream(), but parse the LEN chars of the script at BUF (a
+// private writable mapping of the file) in place: each line is handed to
+// parse_n() as a slice of BUF, and HERE documents are read from BUF too.
+// W is flushed only when its buffer is full.
+static int parseMapped (Parser *p, char *buf, size_t len, Writer *w)
 {
-    if (!c)
-        return;
-
-    dumpTree (c->left, level+1);
+    int nCmd = 1;                   // Command number
+    CMD *cmd;                       // Parsed command
+    size_t pos = 0;                 // Offset of next line in BUF
 
-////fprintf (stdout, "CMD (Level = %d):  ", level);
-    fprintf (stdout, "CMD (Depth = %d):  ", level);
+    parserSetBuffer (p, buf, len, &pos);
 
-    if (c->type == SIMPLE) {
-        if (c->left != NULL)
-            fprintf (stdout, "  SIMPLE HAS LEFT CHILD");
-        else if (c->right != NULL)
-            fprintf (stdout, "  SIMPLE HAS RIGHT CHILD");
-        else {
-            fprintf (stdout, "SIMPLE");
-            dumpArgs (c);
-            dumpRedirect (c);
-        }
+    while (pos < len) {
+        prompt (w, p, nCmd);                       // Prompt for command
 
-    } else if (c->argc > 0) {
-        fprintf (stdout, "  NON-SIMPLE HAS ARGUMENTS");
+        char *line = buf + pos;                 // Slice through the newline
+        char *nl = memchr (line, '\n', len - pos);
+        size_t n = nl ? nl+1 - line : len - pos;
+        pos += n;
 
-    } else if (c->type == SUBCMD) {
-        if (c->right != NULL)
-            fprintf (stdout, "  SUBCMD HAS RIGHT CHILD");
-        else {
-            fprintf (stdout, "SUBCMD");
-            dumpRedirect (c);
-        }
+        n = strnlen (line, n);                  // A NUL ends the line, as
+                                                //   for getline() + strlen()
+        if (parseOne (p, line, n, w))
+            nCmd++;
+    }
 
-    } else if (c->fromType != NONE
-            || c->fromFile != NULL
-            || c->toType != NONE
-            || c->toFile != NULL
-            || c->errType != NONE
-            || c->errFile != NULL) {
-        fprintf (stdout, "  NON-SIMPLE, NON-SUBCMD HAS I/O REDIRECTION");
+    prompt (w, p, nCmd);                        // Final prompt
+    if ((cmd = parserFinish (p)) != NULL) {
+        dump (w, cmd);
+        cmd = freeCMD (cmd);
+    }
+    if (!json && !check && !tokens)
+        wrChar (w, '\n');                       // and newline
+    return EXIT_SUCCESS;
+}
 
-    } else if (c->nLocal > 0) {
-        fprintf (stdout, "  NON-SIMPLE, NON-SUBCMD HAS LOCAL VARIABLES");
 
-    } else if (c->type == PIPE) {
-        fprintf (stdout, "PIPE");
+// Parse the script in the file NAME with parser context P; a regular file is
+// mapped into memory rather than read through stdio; dump to W
+static int parseFile (Parser *p, const char *name, Writer *w)
+{
+    int fd = open (name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat (fd, &st) < 0) {
+        perror (name);
+        return EXIT_FAILURE;
+    }
 
-    } else if (c->type == SEP_AND) {
-        fprintf (stdout, "SEP_AND");
+    char *buf = MAP_FAILED;
+    if (S_ISREG (st.st_mode) && st.st_size > 0)
+        buf = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                    fd, 0);
+
+    int status;
+    if (buf != MAP_FAILED) {
+        close (fd);
+        madvise (buf, st.st_size, MADV_SEQUENTIAL);
+        status = parseMapped (p, buf, st.st_size, w);
+        munmap (buf, st.st_size);
+    } else {                                    // Pipe, empty file, ...
+        FILE *in = fdopen (fd, "r");
+        status = parseStream (p, in, w);
+        fclose (in);
+    }
+    return status;
+}
 
-    } else if (c->type == SEP_OR) {
-        fprintf (stdout, "SEP_OR");
 
-    } else if (c->type == SEP_END) {
-        fprintf (stdout, "SEP_END");
+// Write the parse cache counters S to stderr
+static void printCacheStats (const CacheStats *s)
+{
+    fprintf (stderr, "parsley: cache: %lu hits, %lu misses, %lu bypasses, "
+                     "%lu evictions, %zu entries, %zu bytes\n",
+             s->hits, s->misses, s->bypasses, s->evictions,
+             s->entries, s->bytes);
+}
 
-    } else if (c->type == SEP_BG) {
-        fprintf (stdout, "SEP_BG");
 
-    } else {
-        fprintf (stdout, "NODE HAS INVALID TYPE");
+int main (int argc, char *argv[])
+{
+    BatchOptions bo = {             // Options, also used outside batch mode
+        .nThreads = -1,             //   #worker threads in batch mode (-j)
+        .hereMax = SIZE_MAX,        //   Longest HERE document kept in memory
+        .cacheBytes = 0,            //   Size of parse cache
+    };
+    static const struct option longOpts[] = {
+        {"here-max", required_argument, NULL, 'H'},
+        {"json",     no_argument,       NULL, 'J'},
+        {"cache",    required_argument, NULL, 'C'},
+        {"continue", no_argument,       NULL, 'c'},
+        {"stats",    no_argument,       NULL, 'S'},
+        {"events",   no_argument,       NULL, 'E'},
+        {"check",    no_argument,       NULL, 'K'},
+        {"tokens",   no_argument,       NULL, 'T'},
+        {NULL, 0, NULL, 0}
+    };
+    bool cont = false;              // Continue commands on next line?
+    bool count = false;             // Write counters at exit (--stats)?
+    bool dumpEvents = false;        // Dump from events (--events)?
+    int opt;
+    while ((opt = getopt_long (argc, argv, "j:", longOpts, NULL)) != -1) {
+        if (opt == 'j' && (bo.nThreads = atoi (optarg)) >= 0)
+            continue;
+        if (opt == 'H' && (bo.hereMax = parseSize (optarg)) != (size_t) -1)
+            continue;
+        if (opt == 'C' && (bo.cacheBytes = parseSize (optarg)) != (size_t) -1)
+            continue;
+        if (opt == 'J' && (json = bo.json = true))
+            continue;
+        if (opt == 'c' && (cont = true))
+            continue;
+        if (opt == 'S' && (count = true))
+            continue;
+        if (opt == 'E' && (dumpEvents = true))
+            continue;
+        if (opt == 'K' && (check = true))
+            continue;
+        if (opt == 'T' && (tokens = true))
+            continue;
+        fprintf (stderr, USAGE);
+        return EXIT_FAILURE;
+    }
+    if (cont && bo.nThreads >= 0) {             // Batch mode splits the input
+        fprintf (stderr, "parsley: --continue cannot be used with -j\n");
+        return EXIT_FAILURE;                    //   at line boundaries
+    }
+    if (dumpEvents + check + tokens > 1
+        || ((dumpEvents || check || tokens)
+            && (bo.nThreads >= 0 || json || bo.cacheBytes > 0 || cont))) {
+        fprintf (stderr, USAGE);                // No tree to share, and each
+        return EXIT_FAILURE;                    //   line is a whole command
+    }
+    if (count) {                                // Count from here on; the
+        bo.stats = stats = mallocStats();       //   report follows the output
+        start = statsNow();
+        statsStart (stats);                     //   (atexit() runs handlers
+        atexit (reportStats);                   //   in reverse order)
     }
 
-    fprintf (stdout, "\n");
+    CacheStats cs;
+    int status;
 
-    dumpTree (c->right, level+1);
+    if (bo.nThreads >= 0) {                     // Batch mode
+        FILE *in = stdin;
+        if (optind < argc && !(in = fopen (argv[optind], "r"))) {
+            perror (argv[optind]);
+            return EXIT_FAILURE;
+        }
+        if (bo.nThreads == 0)
+            bo.nThreads = sysconf (_SC_NPROCESSORS_ONLN);
+        if (bo.nThreads <= 0)
+            bo.nThreads = 1;
+        status = batchParse (in, &bo, &cs);
+        if (in != stdin)
+            fclose (in);
+        if (bo.cacheBytes > 0)
+            printCacheStats (&cs);
+        return status;
+    }
+
+    Parser *p = mallocParser();
+    parserSetHereMax (p, bo.hereMax);
+    parserSetCache (p, bo.cacheBytes);
+    parserSetContinue (p, cont);
+
+    Writer *out = mallocWriter (STDOUT_FILENO);     // Buffered stdout
+    if (dumpEvents)
+        events = mallocEventDump (out);
+
+    status = (optind < argc) ? parseFile (p, argv[optind], out)
+                             : parseStream (p, stdin, out);
+    out = freeWriter (out);                     // Flush before the counters
+    if (bo.cacheBytes > 0) {
+        parserCacheStats (p, &cs);
+        printCacheStats (&cs);
+    }
+    events = freeEventDump (events);
+    free (lexeme);
+    freeParser (p);
+    return invalid ? EXIT_FAILURE : status;
 }
@@ -1,9 +1,13 @@
 /* NAME: Michelle Goh
    NetId: mg2657 */
-#include "/c/cs323/Hwk2/parsley.h"
-#define _GNU_SOURCE
+#include "parsley.h"
+#include "scan.h"
+#include "cache.h"
+#include "stats.h"
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <errno.h>
 
@@ -13,474 +17,1328 @@
 // Write message to stderr using format FORMAT and exit.
 #define DIE(format,...)  WARN(format,__VA_ARGS__), exit (EXIT_FAILURE)
 
-int listIndex = 0; //index of token list; keeps place of list during parsing
-int listLen = 0; //length of list; determines which parts of token list to parse
-int error = 0; //indicate error
 
-
-// Struct for each token in sequence 
+// Struct for each token in sequence.  A token is a span of the line being
+// parsed; only TEXT tokens with backslash escapes get a copy of their own.
 typedef struct token 
 {         
-	char *text;                  
 	int type;                    
+	int start; //offset of first char of token in line
+	int len; //#chars of token in line
+	char *text; //static text of an operator, unescaped copy of an escaped
+	            //TEXT token, or NULL until tokenText() needs a string
+	int eq; //offset of the = in the text of a TEXT token that is
+	        //NAME=VALUE (see isLocal()), else -1; found when lexed
+	CMD *here; //HERE document read for this word when its line ended
+	           //(see readHeres()), or NULL
+	struct node *nodes; //subtrees built from this token on, kept for
+	                    //reparse(), or NULL
 }token;
 
-CMD *makeCMD(token **list);
-CMD *makeSequence(token **list);
-bool isLocalFree(char* string);
+// Subtree built from a token on, kept with that token so that reparse() can
+// reuse it while the tokens it was built from (and the one after them, which
+// ended it) are not edited
+typedef struct node
+{
+	int kind; //NODE_STAGE, NODE_PIPE, NODE_ANDOR, or NODE_SEQUENCE
+	int len; //#tokens it was built from
+	CMD *tree;
+	struct node *next; //another subtree built from the same token
+}Node;
+
+#define NODE_STAGE 0 //a [stage]
+#define NODE_PIPE 1 //a [pipeline]; each link of the chain is kept
+#define NODE_ANDOR 2 //an [and-or]; ditto
+#define NODE_SEQUENCE 3 //a [sequence]; ditto
+
+// An entry on the stack that makeCMD() uses in place of recursion: an operand
+// (the tree for the tokens from start on), an operator whose right operand is
+// still to come, or a ( with the SUBCMD that will hold the command inside it
+typedef struct frame
+{
+	int op; //PIPE, SEP_AND, SEP_OR, SEP_END, SEP_BG, or PAR_LEFT; NONE for an operand
+	int start; //first token of the operand, or of the [stage] that the ( is in
+	CMD *tree; //the operand, or the SUBCMD for a (
+}Frame;
+
+// Parser context.  parse_r() keeps all of its state here, so threads that
+// use different contexts can parse at the same time.
+struct parser
+{
+	token *list; //token list of line being parsed
+	int size; //#slots in list; kept from line to line
+	int listIndex; //index of token list; keeps place of list during parsing
+	int listLen; //length of list; determines which parts of token list to parse
+	int error; //indicate error
+	Arena *arena; //arena holding the tree of the current parse
+	char *input; //line being parsed; tokens are spans of it
+	FILE *in; //stream that HERE documents are read from
+	Scanner scan; //finds the end of a TEXT token; fastest one for this CPU
+	char *line; //buffer for lines of HERE documents; kept from line to line
+	size_t nLine; //#chars allocated for line
+	size_t hereMax; //longest HERE document kept in memory; see readHere()
+	char *buf; //buffer that HERE documents are read from instead of in, or NULL
+	size_t bufLen; //#chars in buf
+	size_t *bufPos; //offset of next line in buf
+	Cache *cache; //recently parsed lines and their trees, or NULL
+	bool cont; //continue an incomplete command onto the next line?
+	bool pending; //list holds the tokens of an incomplete command
+	bool glue; //last token of the previous line runs on into this one
+	int leftPar; //#( in the command so far
+	int rightPar; //#) in the command so far
+	int hereNext; //first token that readHeres() has yet to look at
+	bool keep; //keep the subtrees built for reparse()?
+	Frame *stack; //operands and operators of makeCMD(); kept from line to line
+	int stackSize; //#slots in stack
+	int stackLen; //#frames in use
+	char **words; //locals and argv of the [stage] being built; kept from line to line
+	int wordsSize; //#slots in words
+	const ParseEvents *ev; //callbacks of parseEvents()
+	void *evCtx; //their context
+	Arena *scratch; //arena of parseEvents(); reset for each line, not freed
+};
+
+// Text of each operator token, indexed by type
+static char *opText[] = {
+	[RED_IN] = "<", [RED_IN_HERE] = "<<",
+	[RED_OUT] = ">", [RED_OUT_APP] = ">>", [RED_OUT_ERR] = "&>",
+	[RED_ERR] = "2>", [RED_ERR_APP] = "2>>",
+	[PIPE] = "|", [SEP_AND] = "&&", [SEP_OR] = "||",
+	[SEP_END] = ";", [SEP_BG] = "&",
+	[PAR_LEFT] = "(", [PAR_RIGHT] = ")",
+};
+
+// How tightly each operator binds; see parsley.h
+const int opPrec[ERROR+1] = {
+	[PIPE] = 3,
+	[SEP_AND] = 2, [SEP_OR] = 2,
+	[SEP_END] = 1, [SEP_BG] = 1,
+};
+
+#define HERE_BUF (64 * 1024) //#chars buffered between writes to a spilled HERE document
+
+// Operator recognizer: for metachar c, opState[c] gives the operator c by
+// itself and the (at most two) chars that extend it to a two-char operator
+static const struct opState
+{
+	int type; //type of operator c alone
+	char next1; //c next1 is an operator of type type1
+	int type1;
+	char next2; //c next2 is an operator of type type2
+	int type2;
+} opState[128] = {
+	['<'] = {RED_IN, '<', RED_IN_HERE, 0, 0},
+	['>'] = {RED_OUT, '>', RED_OUT_APP, 0, 0},
+	['&'] = {SEP_BG, '&', SEP_AND, '>', RED_OUT_ERR},
+	['|'] = {PIPE, '|', SEP_OR, 0, 0},
+	[';'] = {SEP_END, 0, 0, 0, 0},
+	['('] = {PAR_LEFT, 0, 0, 0, 0},
+	[')'] = {PAR_RIGHT, 0, 0, 0, 0},
+};
+
+CMD *makeCMD(Parser *p);
+static CMD *parseLine(Parser *p, char *line, size_t len);
+static CMD *parseTokens(Parser *p);
+
+// Return the text of token T as a string, copying its span of the line into
+// the arena the first time a string is needed
+char *tokenText(Parser *p, token *t)
+{
+	if(t->text == NULL)
+	{
+		t->text = arenaStrndup(p->arena, &p->input[t->start], t->len);
+	}
+	return t->text;
+}
 
-CMD *parse (char *line)
+// If an earlier parse kept a subtree of kind KIND built from the current token
+// of P (see reparse()), advance past the tokens of the largest one and return
+// it; else return NULL
+static CMD *reuseNode(Parser *p, int kind)
 {
-	listIndex = 0;
-	error = 0;
-	int length = strlen(line);
+	if(!p->keep || p->listIndex >= p->listLen)
+	{
+		return NULL;
+	}
 
-	int leftPar = 0;
-	int rightPar = 0;
-	
-	token **tokenList = malloc(sizeof(token*) * (length+1));
+	Node *best = NULL;
+	for(Node *n = p->list[p->listIndex].nodes; n != NULL; n = n->next)
+	{
+		if(n->kind == kind && (best == NULL || n->len > best->len))
+		{
+			best = n;
+		}
+	}
+	if(best == NULL)
+	{
+		return NULL;
+	}
+	p->listIndex += best->len;
+	return best->tree;
+}
 
-	int index = 0;
+// Keep TREE, a subtree of kind KIND built from token START up to the current
+// token of P, for later parses (only when p->keep is set)
+static void keepNode(Parser *p, int kind, int start, CMD *tree)
+{
+	if(!p->keep)
+	{
+		return;
+	}
+
+	Node *n = arenaAlloc(p->arena, sizeof(*n));
+	n->kind = kind;
+	n->len = p->listIndex - start;
+	n->tree = tree;
+	n->next = p->list[start].nodes;
+	p->list[start].nodes = n;
+}
 
-	for(int i = 0; i < length; i++) 
+// Return a pointer to slot INDEX of the token list of P, doubling the list
+// first if it is full
+token *tokenSlot(Parser *p, int index)
+{
+	if(index >= p->size)
 	{
-		int special = true;
-		if(isspace(line[i])) // ignore whitespace and continue finding token
-		{                          
-			continue;
-		} 
-		else if(line[i] == '\\') //escape next char and continue finding token
-		{ 
-			if(i+1 < length) //add char to string
-			{
-				i++;
-				special = false;
-			}
-			else //add backslash
-			{     
-				token *item = malloc(sizeof(token));
-				item->text = "\\";
-				item->type = TEXT;
+		p->size *= 2;
+		p->list = realloc(p->list, sizeof(token) * p->size);
+		STATS_ALLOC(sizeof(token) * p->size);
+	}
+	return &p->list[index];
+}
 
-				tokenList[index] = item;
-				break;
-			}              
-			
-		}
-		else if(line[i] == '#') //everything after # is ignored (comment)
-		{                     
-			break;
+// Return an unescaped copy of the LEN chars of line at START: each backslash
+// is dropped and the char after it is kept, except a final backslash
+char *unescape(Parser *p, int start, int len)
+{
+	char *text = arenaAlloc(p->arena, len+1);
+	int n = 0;
+
+	for(int i = start; i < start+len; i++)
+	{
+		if(p->input[i] == '\\' && i+1 < start+len)
+		{
+			i++;
 		}
+		text[n++] = p->input[i];
+	}
+	text[n] = '\0';
+
+	return text;
+}
 
-		//text found
+// Close the descriptor at FDP; called when the arena holding it is released
+static void closeFd(void *fdp)
+{
+	close(*(int *) fdp);
+}
 
-		token *item = malloc(sizeof(token));
+// Return a descriptor for an anonymous file to hold a HERE document that is
+// too large to keep in memory, or -1 if none can be made.  The descriptor
+// belongs to the arena and is closed with it.
+static int spillFd(Parser *p)
+{
+	int fd = memfd_create("parsley-here", MFD_CLOEXEC);
+	if(fd < 0) //no memfd; use an unlinked temp file instead
+	{
+		FILE *tmp = tmpfile();
+		if(tmp != NULL)
+		{
+			fd = fcntl(fileno(tmp), F_DUPFD_CLOEXEC, 0);
+			fclose(tmp);
+		}
+	}
+	if(fd >= 0)
+	{
+		int *fdp = arenaAlloc(p->arena, sizeof(*fdp));
+		*fdp = fd;
+		arenaDefer(p->arena, closeFd, fdp);
+	}
+	return fd;
+}
 
-		bool metaChar = false;
+// Same as readHere(), but take the lines from p->buf (see parserSetBuffer())
+// and leave the document in place: the NUL that ends it overwrites the first
+// char of the terminator line.  Only a document that runs to the end of the
+// buffer is copied, since there is no char after it to overwrite.  The
+// document is already in memory, so p->hereMax does not apply.
+static bool readHereBuf(Parser *p, char *end, size_t endLen, CMD *tree)
+{
+	char *body = p->buf + *p->bufPos;
+	size_t pos = *p->bufPos;
 
-		if(special)
+	while(pos < p->bufLen)
+	{
+		char *line = p->buf + pos;
+		char *nl = memchr(line, '\n', p->bufLen - pos);
+		size_t n = nl ? nl+1 - line : p->bufLen - pos;
+
+		if(n == endLen+1 && nl != NULL && memcmp(line, end, endLen) == 0)
 		{
-			int meta;
-			for(meta = 0; meta < 7; meta++)
-			{
-				if(line[i] == METACHAR[meta])
-				{
-					metaChar = true;
-					break;
-				}
-			}
-			if(metaChar) //exit for loop or continues don't work
-			{	
-				if(i+1 < length)
-				{
-					if(((line[i] != '(') && (line[i] != ')')) &&
-					(line[i+1] == METACHAR[meta] || line[i+1] == '>')) //if have next meta char, it is same char or &>
-					{
-
-						char *subStr = malloc(sizeof(char)*3);
-						memcpy(subStr, &line[i], 2);
-						subStr[2] = '\0';
-
-						item->text = subStr;
-
-						if(line[i+1] == '>') //set type according to metachar
-						{
-							if(line[i] == '>')
-							{
-								item->type = RED_OUT_APP;
-							}
-							else
-							{
-								item->type = RED_OUT_ERR;
-							}
-						}
-						else if(line[i+1] == '<')
-						{
-							item->type = RED_IN_HERE;
-						}
-						else if(line[i+1] == '&')
-						{
-							item->type = SEP_AND;
-						}
-						else if(line[i+1] == '|')
-						{
-							item->type = SEP_OR;
-						}
-
-						i = i+1; //increment
-						tokenList[index] = item;
-						index++;
-						continue;
-					}
-					else //redirects, bc next slot should not be empty
-					{
-						char *subStr = malloc(sizeof(char)*2);
-						memcpy(subStr, &line[i], 1);
-						subStr[1] = '\0';
-
-						item->text = subStr;
-
-						if(line[i] == '<')
-						{
-							item->type = RED_IN;
-						}
-						else if(line[i] == '>')
-						{
-							item->type = RED_OUT;
-						}
-						else if(line[i] == '|')
-						{
-							item->type = PIPE;
-						}
-						else if(line[i] == '(')
-						{
-							leftPar++;
-							item->type = PAR_LEFT;
-						}
-						else if(line[i] == ')')
-						{
-							rightPar++;
-							item->type = PAR_RIGHT;
-						}
-						else if(line[i] == ';')
-						{
-							item->type = SEP_END;
-						}
-						else if(line[i] == '&')
-						{
-							item->type =  SEP_BG;
-						}
-
-						tokenList[index] = item;
-						index++;
-						continue;
-					}
-				}
-				else //next char doesn't exist, isn't redirection
-				{
-					char *subStr = malloc(sizeof(char)*2);
-					memcpy(subStr, &line[i], 1);
-					subStr[1] = '\0';
-
-					item->text = subStr;
-
-					if(line[i] == ')')
-					{
-						rightPar++;
-						item->type = PAR_RIGHT;
-					}
-					else if(line[i] == ';')
-					{
-						item->type = SEP_END;
-					}
-					else if(line[i] == '&')
-					{
-						item->type =  SEP_BG;
-					}
-					else //missing filename
-					{
-						fprintf(stderr, "parsley: missing filename\n");
-						return NULL;
-					}
-
-					tokenList[index] = item;
-					index++;
-					continue;
-				}
-			}
+			*line = '\0';
+			*p->bufPos = pos + n;
+			tree->fromFile = body;
+			return true;
 		}
+		pos += n;
+	}
 
-		//if not metachar, then it is TEXT
+	*p->bufPos = pos;
+	tree->fromFile = arenaStrndup(p->arena, body, pos - (body - p->buf));
+	return true;
+}
 
-		char buf[length+1]; //char buffer
-		int strInd = 1;
-		
-		buf[0] = line[i];
-		buf[1] = '\0';
-		
-		i++;
+// Same as readHere(), but take the lines from p->in.  A body of at most
+// p->hereMax chars becomes one string in tree->fromFile that belongs to the
+// arena; it is built in one buffer that doubles when full, so reading it
+// takes time linear in its size.  A larger body streams into an anonymous
+// file whose descriptor (positioned at the start) and length go in
+// tree->fromFd and tree->fromLen, so parser memory stays bounded however
+// large the document.
+static bool readHereIn(Parser *p, char *end, size_t endLen, CMD *tree)
+{
+	size_t size = 256; //#chars allocated for body
+	size_t len = 0; //#chars in body (or not yet written to fd)
+	size_t total = 0; //#chars in document
+	char *body = malloc(size);
+	STATS_ALLOC(size);
+	size_t max = p->hereMax; //#chars to keep in memory
+	int fd = -1; //descriptor once spilled
+	bool ok = true;
+	size_t nLine = p->nLine; //size of the line buffer, to see getline() grow it
+
+	while(getline(&p->line, &p->nLine, p->in) > 0)
+	{
+		if(p->nLine != nLine)
+		{
+			nLine = p->nLine;
+			STATS_ALLOC(nLine);
+		}
+		size_t n = strlen(p->line); //a NUL ends the line, as for strcmp()
 
-		while(i < length) //find where token starts and stops; build string of TEXT
+		if(n == endLen+1 && p->line[endLen] == '\n' && memcmp(p->line, end, endLen) == 0)
 		{
-			if(isspace(line[i])) // end of token
-			{                          
-				item->text = strdup(buf);
-				item->type = TEXT;
+			break;
+		}
+		total += n;
 
-				tokenList[index] = item;
-				index++;
-				break;
+		if(total > max) //spill once; if that fails, keep it all in memory
+		{
+			max = SIZE_MAX;
+			if((fd = spillFd(p)) >= 0)
+			{
+				size = HERE_BUF; //body is now a write buffer for fd
+				body = realloc(body, len > size ? len : size);
+				STATS_ALLOC(len > size ? len : size);
 			}
-			else if(line[i] == '\\') //escape next char and continue finding token
-			{                     
-				if(i+1 < length) //add char to string
-				{
-					i++;
-					buf[strInd] = line[i];
-					buf[strInd+1] = '\0';
-					
-					i++;
-					strInd++;
-				}
-				else //add backslash
-				{
-					buf[strInd] = line[i];
-					buf[strInd+1] = '\0';
+		}
 
-					i++;
-					
-					strInd++;
-					break;
-				}
+		if(fd >= 0 && len + n > size) //flush before the buffer overflows
+		{
+			if(!(ok = writeAll(fd, body, len)))
+			{
+				break;
 			}
-			else //can be metachar
+			len = 0;
+		}
+		if(fd >= 0 && n > size) //line too long to buffer
+		{
+			if(!(ok = writeAll(fd, p->line, n)))
 			{
-				for(int meta = 0; meta < 7; meta++)
-				{
-					if(line[i] == METACHAR[meta])
-					{
-						metaChar = true;
-						break;
-					}
-				}
-				
-				if(metaChar)
-				{
-					item->text = strdup(buf);
-					item->type = TEXT;
-
-					tokenList[index] = item;
-					index++;
-					break;
-				}
-				else //not metachar, so add
-				{
-					buf[strInd] = line[i];
-					buf[strInd+1] = '\0';
-
-					i++;
-					strInd++;
-				}
+				break;
 			}
+			continue;
 		}
 
-		if(i >= length) //finished
+		if(len + n + 1 > size)
 		{
-			item->text = strdup(buf);
-			item->type = TEXT;
-
-			tokenList[index] = item;
-			index++;
-			break;
+			while(len + n + 1 > size)
+			{
+				size *= 2;
+			}
+			body = realloc(body, size);
+			STATS_ALLOC(size);
 		}
+		memcpy(body + len, p->line, n);
+		len += n;
+	}
 
-		i--; //decrement b/c the for loop increments for us
+	if(fd < 0)
+	{
+		body[len] = '\0';
+		tree->fromFile = arenaAdopt(p->arena, realloc(body, len+1)); //body lives with the tree
+		return true;
 	}
 
-	listLen = index; //last index of list plus one is size of list
-	if(listLen == 0)
+	ok = ok && writeAll(fd, body, len) && lseek(fd, 0, SEEK_SET) == 0;
+	free(body);
+	if(!ok)
 	{
-		free(tokenList);
-		return NULL;
+		p->error = ERROR;
+		fprintf(stderr, "parsley: HERE document: %s\n", strerror(errno));
+		return false;
 	}
+	tree->fromFd = fd;
+	tree->fromLen = total;
+	return true;
+}
 
-	if(leftPar != rightPar)
+// Read the lines of a HERE document up to (but not including) a line
+// containing just the text of token WORD, or up to end of file, and store
+// them in TREE; the lines come from p->buf if there is one (see readHereBuf())
+// and else from p->in (see readHereIn()).  Return false on error.
+bool readHere(Parser *p, token *word, CMD *tree)
+{
+	if(word->here != NULL) //already read
 	{
-		for(int f = 0; f < listLen; f++)
-		{
+		tree->fromFile = word->here->fromFile;
+		tree->fromFd = word->here->fromFd;
+		tree->fromLen = word->here->fromLen;
+		return true;
+	}
 
-			free(tokenList[f]->text);
+	char *end = tokenText(p, word); //terminator
+	size_t endLen = strlen(end);
+	int phase = statsPhase(PHASE_HERE);
 
+	bool ok = (p->buf != NULL) ? readHereBuf(p, end, endLen, tree)
+	                           : readHereIn(p, end, endLen, tree);
 
-			free(tokenList[f]);
-		}
-		free(tokenList);
-		fprintf(stderr, "parse: uneven parans\n");
-		return NULL;
-	}
+	statsPhase(phase);
+	return ok;
+}
+
+// Allocate a CMD struct from the arena; same as mallocCMD() otherwise
+CMD *arenaCMD(Parser *p, int type, CMD *left, CMD *right)
+{
+	static char *noArgs[] = {NULL}; //shared empty argv for non-SIMPLE nodes
+
+	CMD *new = arenaAlloc(p->arena, sizeof(*new));
+
+	new->type = type;
+	new->argc = 0;
+	new->argv = noArgs;
+	new->nLocal = 0;
+	new->locVar = NULL;
+	new->locVal = NULL;
+	new->fromType = NONE;
+	new->fromFile = NULL;
+	new->fromFd = -1;
+	new->fromLen = 0;
+	new->toType = NONE;
+	new->toFile = NULL;
+	new->errType = NONE;
+	new->errFile = NULL;
+	new->left = left;
+	new->right = right;
+	new->arena = p->arena;
+
+	return new;
+}
+
+Parser *mallocParser (void)
+{
+	Parser *p = malloc(sizeof(*p));
+
+	p->size = 64; //#slots in token list; grows as needed
+	p->list = malloc(sizeof(token) * p->size);
+	p->listIndex = 0;
+	p->listLen = 0;
+	p->error = 0;
+	p->arena = NULL;
+	p->input = NULL;
+	p->in = stdin;
+	p->scan = bestScanner();
+	p->line = NULL;
+	p->nLine = 0;
+	p->hereMax = SIZE_MAX;
+	p->buf = NULL;
+	p->bufLen = 0;
+	p->bufPos = NULL;
+	p->cache = NULL;
+	p->cont = false;
+	p->pending = false;
+	p->glue = false;
+	p->leftPar = 0;
+	p->rightPar = 0;
+	p->hereNext = 0;
+	p->keep = false;
+	p->stackSize = 64; //#frames in stack; grows as needed
+	p->stack = malloc(sizeof(Frame) * p->stackSize);
+	p->stackLen = 0;
+	p->wordsSize = 64; //#slots in words; grows as needed
+	p->words = malloc(sizeof(char*) * p->wordsSize);
+	p->ev = NULL;
+	p->evCtx = NULL;
+	p->scratch = NULL;
+
+	return p;
+}
+
+void parserSetInput (Parser *p, FILE *in)
+{
+	p->in = in;
+}
 
-	CMD *tree = makeCMD(tokenList);
+void parserSetHereMax (Parser *p, size_t max)
+{
+	p->hereMax = max;
+}
 
-	if(error == ERROR)
+void parserSetCache (Parser *p, size_t maxBytes)
+{
+	p->cache = freeCache(p->cache);
+	if(maxBytes > 0)
 	{
-		for(int f = 0; f < listLen; f++)
-		{
+		p->cache = mallocCache(maxBytes);
+	}
+}
 
-		if(tokenList[f]->type != TEXT)
-		{
-			free(tokenList[f]->text);
-		}
-		
-		free(tokenList[f]);
-		}
-		free(tokenList);
+void parserCacheStats (Parser *p, CacheStats *s)
+{
+	if(p->cache != NULL)
+	{
+		cacheStats(p->cache, s);
+	}
+	else
+	{
+		memset(s, 0, sizeof(*s));
+	}
+}
+
+void parserSetBuffer (Parser *p, char *buf, size_t len, size_t *pos)
+{
+	p->buf = buf;
+	p->bufLen = len;
+	p->bufPos = pos;
+}
+
+void parserSetContinue (Parser *p, bool on)
+{
+	p->cont = on;
+}
+
+bool parserPending (Parser *p)
+{
+	return p->pending;
+}
+
+CMD *parserFinish (Parser *p)
+{
+	if(!p->pending)
+	{
 		return NULL;
 	}
+	p->pending = false;
+	p->glue = false;
+	p->listIndex = 0;
+	p->error = 0;
+	return parseTokens(p);
+}
+
+Parser *freeParser (Parser *p)
+{
+	if(p)
+	{
+		free(p->list);
+		free(p->stack);
+		free(p->words);
+		free(p->line);
+		freeArena(p->arena);
+		freeArena(p->scratch);
+		freeCache(p->cache);
+		free(p);
+	}
+	return NULL;
+}
+
+CMD *parse (char *line)
+{
+	static Parser *p = NULL; //context shared by all calls; not reentrant
+
+	if(p == NULL)
+	{
+		p = mallocParser();
+	}
+	return parse_r(p, line);
+}
+
+CMD *parse_r (Parser *p, char *line)
+{
+	return parse_n(p, line, strlen(line));
+}
 
+// Return the length of the key for LINE (of LEN chars) in a parse cache: the
+// chars up to and including the # that starts a comment (which the lexer
+// ignores along with the rest of the line), or the whole line
+static size_t cacheKeyLen(const char *line, size_t len)
+{
+	bool start = true; //could a token start here?
 
-	for(int f = 0; f < listLen; f++)
+	for(size_t i = 0; i < len; i++)
 	{
-		if(tokenList[f]->type == RED_IN_HERE)
+		int cc = CLASS(line[i]);
+
+		if(cc & CC_ESCAPE)
 		{
-			free(tokenList[f]->text);
-			free(tokenList[f]);
-			if(f+1 < listLen)
-			{
-				free(tokenList[f+1]->text);
-				f++;
-			}
+			i++;
+			start = false;
 		}
-		else if(tokenList[f]->type != TEXT)
+		else if(cc & (CC_SPACE | CC_META))
 		{
-			free(tokenList[f]->text);
+			start = true;
 		}
-		else if(isLocalFree(tokenList[f]->text))
+		else if((cc & CC_COMMENT) && start)
 		{
-			free(tokenList[f]->text);
+			return i+1;
 		}
-		
-		free(tokenList[f]);
+		else
+		{
+			start = false;
+		}
+	}
+	return len;
+}
+
+// Parse the LEN chars at LINE; same as parse_n() but without the --stats
+// counters
+static CMD *cacheLine(Parser *p, char *line, size_t len)
+{
+	if(p->cache == NULL || p->pending) //a continuation line is not a command by itself
+	{
+		return parseLine(p, line, len);
+	}
+
+	size_t keyLen = cacheKeyLen(line, len);
+	if(memmem(line, keyLen, "<<", 2) != NULL) //may read a HERE document
+	{
+		cacheBypass(p->cache);
+		return parseLine(p, line, len);
 	}
 
-	free(tokenList);
+	uint64_t hash = cacheHash(line, keyLen);
+	CMD *tree = cacheLookup(p->cache, line, keyLen, hash);
+	if(tree != NULL) //hit: share the cached tree
+	{
+		arenaRetain(tree->arena);
+		return tree;
+	}
 
+	tree = parseLine(p, line, len);
+	if(tree != NULL) //errors and incomplete commands are not cached
+	{
+		cacheInsert(p->cache, line, keyLen, hash, tree);
+	}
 	return tree;
 }
 
-bool isLocalFree(char* string)
+CMD *parse_n (Parser *p, char *line, size_t len)
 {
-	bool goodName = false;
-	bool var = false;
+	if(statsCur == NULL) //not counting
+	{
+		return cacheLine(p, line, len);
+	}
+
+	uint64_t start = statsNow();
+	int phase = statsPhase(PHASE_LEX); //until parseTokens() switches to PHASE_PARSE
+	CMD *tree = cacheLine(p, line, len);
 
-	for(int i = 0; i < strlen(string); i++)
+	statsPhase(phase);
+	statsLine(start);
+	return tree;
+}
+
+// Read the HERE documents for the << operators among the first TO tokens of
+// the list of P now, since each starts on the line after its word even when
+// the command goes on past that line; keep each with its word for readHere().
+// Return false on error.
+static bool readHeres(Parser *p, int to)
+{
+	int i = p->hereNext;
+
+	p->hereNext = (to > i+1) ? to-1 : i; //its word may be on the next line
+	for( ; i+1 < to; i++)
 	{
-		goodName = false;
+		token *word = &p->list[i+1];
 
-			if(string[i] == '=') //split NAME and VALUE
+		if(p->list[i].type == RED_IN_HERE && word->type == TEXT && word->here == NULL)
+		{
+			CMD *doc = arenaCMD(p, NONE, NULL, NULL);
+			if(!readHere(p, word, doc))
 			{
-				var = true;
-				break;
-			}
-			
-			for(int j = 0; j < strlen(VARCHR); j++) //check every char
-			{
-				if(string[i] == VARCHR[j]) //check valid NAME
-				{
-					goodName = true;
-					break;
-				}
+				return false;
 			}
+			word->here = doc;
+		}
+	}
+	return true;
+}
 
-			if(!goodName)
-			{
-				return false; //not NAME=VALUE
-			}
+// Is the backslash at offset I of the LEN chars being parsed by P followed by
+// the newline that ends them, so that the command continues on the next line
+// (see parserSetContinue())?
+static bool continues(Parser *p, int i, int len)
+{
+	return p->cont && i+2 == len && p->input[i+1] == '\n';
+}
+
+// Return the offset of the = in the LEN chars at S if they are NAME=VALUE
+// (a local), else -1
+static int findAssign(const char *s, int len)
+{
+	if(len == 0 || (CLASS(s[0]) & CC_DIGIT))
+	{
+		return -1;
 	}
-	return var;
+
+	for(int i = 0; i < len; i++)
+	{
+		if(s[i] == '=') //split NAME and VALUE
+		{
+			return (i > 0) ? i : -1;
+		}
+		else if(!(CLASS(s[i]) & CC_VARCHR)) //check valid NAME
+		{
+			return -1; //not NAME=VALUE
+		}
+	}
+	return -1;
+}
+
+// Join the TEXT token at index FIRST of the list of P (the first one on this
+// line) to the token before it (the last one on the previous line, which ended
+// with a backslash-newline), and remove it from the list of LEN tokens
+static void glueToken(Parser *p, int first, int len)
+{
+	token *last = &p->list[first-1];
+	char *head = last->text; //copied when its line ended
+	char *tail = tokenText(p, &p->list[first]);
+	size_t nHead = strlen(head);
+	size_t nTail = strlen(tail);
+
+	last->text = arenaAlloc(p->arena, nHead + nTail + 1);
+	memcpy(last->text, head, nHead);
+	memcpy(last->text + nHead, tail, nTail + 1);
+	last->eq = findAssign(last->text, nHead + nTail);
+
+	memmove(&p->list[first], &p->list[first+1], (len - first - 1) * sizeof(token));
 }
 
-	bool isLocal(token* item, char **NAME, char **VALUE)
+#define LEX_END -1 //a comment or a lone backslash ends the line
+#define LEX_MORE -2 //a backslash-newline ends the line (see continues())
+#define LEX_ERROR -3 //an operator that needs a filename ends the line
+
+// Lex the token that starts at offset I (not whitespace) of the LENGTH chars
+// of p->input into slot INDEX of the token list of P, counting parens in P.
+// Return the offset just past it, or LEX_END, LEX_MORE, or LEX_ERROR if no
+// token starts there.  JOIN means the token continues a word from the
+// previous line, so a # does not start a comment.
+static int lexToken(Parser *p, int i, int length, int index, bool join)
+{
+	char *line = p->input;
+	int cc = CLASS(line[i]);
+	int start = i; //first char of token
+	bool escaped = false;
+
+	if(cc & CC_ESCAPE) //escape next char and continue finding token
+	{ 
+		if(continues(p, i, length)) //command goes on to the next line
+		{
+			return LEX_MORE;
+		}
+		else if(i+1 < length) //add char to string
+		{
+			i++;
+			escaped = true;
+		}
+		else //lone backslash at end of line is dropped
+		{     
+			return LEX_END;
+		}              
+	}
+	else if((cc & CC_COMMENT) && !join) //everything after # is ignored (comment)
+	{                     
+		return LEX_END;
+	}
+	else if(cc & CC_META) //operator: one char or two
 	{
-		char *string = item->text;
-		if(isdigit(string[0]))
+		const struct opState *op = &opState[(unsigned char) line[i]];
+		token *item = tokenSlot(p, index);
+		item->type = op->type;
+		item->start = i;
+		item->len = 1;
+
+		if(i+1 < length && op->next1 && line[i+1] == op->next1)
 		{
-			return false;
+			item->type = op->type1;
+			item->len = 2;
 		}
-		else
+		else if(i+1 < length && op->next2 && line[i+1] == op->next2)
 		{
-			int partition = -1;
-			bool goodName;
+			item->type = op->type2;
+			item->len = 2;
+		}
+		else if(i+1 == length && item->type != PAR_RIGHT &&
+			item->type != SEP_END && item->type != SEP_BG) //missing filename
+		{
+			return LEX_ERROR;
+		}
 
-			for(int i = 0; i < strlen(string); i++)
-			{
-				goodName = false;
+		if(item->type == PAR_LEFT)
+		{
+			p->leftPar++;
+		}
+		else if(item->type == PAR_RIGHT)
+		{
+			p->rightPar++;
+		}
+
+		item->text = opText[item->type];
+		item->eq = -1;
+		item->here = NULL;
+		item->nodes = NULL;
+		return i + item->len;
+	}
+
+	//TEXT found; find where it stops, and copy it only if it has escapes
+
+	i++;
 
-			if(string[i] == '=') //split NAME and VALUE
+	while(i < length)
+	{
+		i = p->scan(line, i, length); //skip to whitespace, metachar, or backslash
+
+		if(i < length && (CLASS(line[i]) & CC_ESCAPE)) //escape next char and continue finding token
+		{                     
+			if(continues(p, i, length)) //token runs on into the next line
 			{
-				partition = i;
+				p->glue = true;
 				break;
 			}
-			
-			for(int j = 0; j < strlen(VARCHR); j++) //check every char
-			{
-				if(string[i] == VARCHR[j]) //check valid NAME
-				{
-					goodName = true;
-					break;
-				}
-			}
+			escaped = true;
+			i = (i+1 < length) ? i+2 : i+1; //final backslash is kept
+		}
+		else // whitespace or metachar ends token
+		{
+			break;
+		}
+	}
+
+	token *item = tokenSlot(p, index);
+	item->type = TEXT;
+	item->start = start;
+	item->len = i - start;
+	item->text = escaped ? unescape(p, start, i - start) : NULL;
+	item->eq = escaped ? findAssign(item->text, strlen(item->text))
+	                   : findAssign(&line[start], i - start);
+	item->here = NULL;
+	item->nodes = NULL;
+
+	return i;
+}
+
+// Lex the LENGTH chars of p->input into the token list of P from slot INDEX
+// on; GLUE means that the first token continues a word from the previous
+// line.  Set *MORE if the line ends with a backslash-newline.  Return the
+// slot just past the last token.  An operator that needs a filename but ends
+// the line is the last token, and sets p->error.
+static int lexLine(Parser *p, int length, int index, bool glue, bool *more)
+{
+	char *line = p->input;
+
+	for(int i = 0; i < length; ) 
+	{
+		if(CLASS(line[i]) & CC_SPACE) // ignore whitespace and continue finding token
+		{                          
+			i++;
+			continue;
+		} 
+
+		int next = lexToken(p, i, length, index, glue && i == 0);
 
-			if(!goodName)
+		if(next == LEX_MORE)
+		{
+			*more = true;
+			if(glue && i == 0) //nothing else on this line
 			{
-				return false; //not NAME=VALUE
+				p->glue = true;
 			}
+			break;
+		}
+		else if(next == LEX_ERROR)
+		{
+			p->error = ERROR;
+			index++;
+			break;
 		}
+		else if(next == LEX_END)
+		{
+			break;
+		}
+
+		index++;
+		i = next;
+	}
+
+	return index;
+}
+
+// Return 1 if the N tokens of a line, with LEFT ( and RIGHT ), may make a
+// command, 0 if there are none, or -1 (after reporting it) if they cannot:
+// lexing stopped at an operator with no filename (BAD), or the ( and ) do
+// not pair up
+static int checkLine(bool bad, int n, int left, int right)
+{
+	if(bad)
+	{
+		fprintf(stderr, "parsley: missing filename\n");
+		return -1;
+	}
+	if(n == 0)
+	{
+		return 0;
+	}
+	if(left != right)
+	{
+		fprintf(stderr, "parse: uneven parans\n");
+		return -1;
+	}
+	return 1;
+}
+
+// Parse the LEN chars at LINE; same as parse_n() but without the cache.  If
+// the command is incomplete, the tokens found so far are kept in P and the
+// next call adds the tokens of the next line to them.
+static CMD *parseLine(Parser *p, char *line, size_t len)
+{
+	if(!p->pending) //start a new command
+	{
+		p->arena = mallocArena();
+		p->listLen = 0;
+		p->leftPar = 0;
+		p->rightPar = 0;
+		p->hereNext = 0;
+	}
+	p->pending = false;
+	p->listIndex = 0;
+	p->error = 0;
+	p->input = line;
+	int length = len;
+
+	int first = p->listLen; //tokens before first came from earlier lines
+	bool glue = p->glue; //does the first token run on from the previous line?
+	bool more = false; //does the line end with a backslash-newline?
+	p->glue = false;
+
+	int index = lexLine(p, length, first, glue, &more);
+	if(p->error == ERROR)
+	{
+		checkLine(true, index, p->leftPar, p->rightPar); //missing filename
+		p->arena = freeArena(p->arena);
+		return NULL;
+	}
 
-		if(partition > 0)
+	if(glue && index > first && p->list[first].type == TEXT && p->list[first].start == 0)
+	{
+		glueToken(p, first, index);
+		index--;
+	}
+	p->listLen = index; //last index of list plus one is size of list
+
+	if(p->cont && (more || p->leftPar > p->rightPar)) //wait for the rest
+	{
+		for(int i = first; i < index; i++) //copy what is left of this line,
+		{                                  //which the caller may reuse
+			tokenText(p, &p->list[i]);
+		}
+		if(!more && !readHeres(p, index)) //a backslash-newline does not end the line
 		{
-			char *name = malloc(sizeof(char)*(partition+1)); //partition chars in NAME
-			memcpy(name, string, partition);
-			name[partition] = '\0';
+			p->arena = freeArena(p->arena);
+			return NULL;
+		}
+		p->pending = true;
+		return NULL;
+	}
 
-			*NAME = name; //set name of variable
+	return parseTokens(p);
+}
 
-			int stringLen = strlen(string);
+// Build the tree for the whole command in the token list of P
+static CMD *parseTokens(Parser *p)
+{
+	if(checkLine(false, p->listLen, p->leftPar, p->rightPar) <= 0)
+	{
+		p->arena = freeArena(p->arena);
+		return NULL;
+	}
 
-			char *value = malloc(sizeof(char)*(stringLen - partition));
+	int phase = statsPhase(PHASE_PARSE);
+	CMD *tree = makeCMD(p);
+	statsPhase(phase);
 
-			if(partition != stringLen-1)
-			{
-			memcpy(value, &string[partition+1], stringLen - partition - 1);
-			value[partition] = '\0';
+	if(p->error == ERROR || tree == NULL)
+	{
+		p->arena = freeArena(p->arena); //so is any partial tree
+		return NULL;
+	}
+
+	p->arena = NULL; //tree now owns the arena; freeCMD() releases it
+
+	return tree;
+}
+
+// A line kept with its tokens and tree so that edits to it can be re-parsed
+// (see reparse()).  Tokens, their copies, kept subtrees, and trees all come
+// from one arena, which is replaced only when it is mostly garbage.
+struct parse
+{
+	char *text; //the line, NUL-terminated
+	int len; //#chars in text
+	int size; //#chars allocated for text
+	token *list; //tokens of text
+	int listLen; //#tokens
+	int listSize; //#slots allocated for list
+	int comment; //offset of the # that starts a comment (or where a lexing
+	             //error stopped), else len
+	bool bad; //did lexing stop with an error?
+	int leftPar; //#( in list
+	int rightPar; //#) in list
+	Arena *arena; //arena for the tokens and trees
+	size_t arenaBase; //size of arena after the last full parse
+	CMD *tree; //tree for text, or NULL if it has errors
+};
+
+// Return the index of the first token in the LEN tokens at LIST that ends at
+// or after offset OFF, or LEN if there is none
+static int tokenEndingAt(token *list, int len, int off)
+{
+	int lo = 0, hi = len;
 
-			*VALUE = value;
+	while(lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if(list[mid].start + list[mid].len < off)
+		{
+			lo = mid + 1;
 		}
 		else
 		{
-			value [0] = '\0';
-			*VALUE = value;
+			hi = mid;
 		}
+	}
+	return lo;
+}
 
-			return true;
+// Return the index of the first token in the LEN tokens at LIST that starts
+// at or after offset OFF, or LEN if there is none
+static int tokenStartingAt(token *list, int len, int off)
+{
+	int lo = 0, hi = len;
+
+	while(lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if(list[mid].start < off)
+		{
+			lo = mid + 1;
 		}
 		else
 		{
-			return false;
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+// Bring the tokens of PS up to date after the DELLEN chars at offset OFF of
+// its text were replaced by INSLEN chars, using P to lex.  Lexing restarts at
+// the token that the edit touches (or just follows) and stops as soon as a
+// token starts where an old token past the edit starts (moved by the edit),
+// since from there on the text and so the tokens are the same.  Subtrees kept
+// with earlier tokens that looked at a token that changed are dropped.
+static void relex(Parser *p, Parse *ps, int off, int delLen, int insLen)
+{
+	token *old = ps->list;
+	int n = ps->listLen;
+	int delta = insLen - delLen;
+
+	int k = tokenEndingAt(old, n, off); //first token that may change
+	int from = (k < n && old[k].start < off) ? old[k].start : off;
+	if(from > ps->comment) //the edit is in a comment
+	{
+		from = ps->comment;
+	}
+	int c = tokenStartingAt(old, n, off + delLen); //first token past the edit
+	int m = n; //first old token kept after the ones lexed again
+
+	p->input = ps->text;
+	p->leftPar = 0;
+	p->rightPar = 0;
+
+	int count = 0; //#tokens lexed again, in p->list
+	int i = from;
+	int comment = ps->len;
+	bool bad = false;
+	bool synced = false;
+	while(i < ps->len)
+	{
+		if(CLASS(ps->text[i]) & CC_SPACE)
+		{
+			i++;
+			continue;
+		}
+
+		while(c < n && old[c].start + delta < i)
+		{
+			c++;
+		}
+		if(c < n && old[c].start + delta == i) //in step with the old tokens
+		{
+			m = c;
+			synced = true;
+			break;
+		}
+
+		int next = lexToken(p, i, ps->len, count, false);
+		if(next < 0) //LEX_END or LEX_ERROR
+		{
+			comment = i;
+			bad = (next == LEX_ERROR);
+			break;
+		}
+		count++;
+		i = next;
+	}
+	if(synced)
+	{
+		comment = ps->comment + delta;
+		bad = ps->bad;
+	}
+
+	for(int j = k; j < m; j++) //tokens dropped
+	{
+		if(old[j].type == PAR_LEFT)
+		{
+			ps->leftPar--;
+		}
+		else if(old[j].type == PAR_RIGHT)
+		{
+			ps->rightPar--;
+		}
+	}
+	ps->leftPar += p->leftPar;
+	ps->rightPar += p->rightPar;
+
+	int len = k + count + (n - m);
+	if(len > ps->listSize)
+	{
+		while(len > ps->listSize)
+		{
+			ps->listSize *= 2;
 		}
+		ps->list = realloc(ps->list, sizeof(token) * ps->listSize);
+		STATS_ALLOC(sizeof(token) * ps->listSize);
+	}
+	memmove(&ps->list[k + count], &ps->list[m], sizeof(token) * (n - m));
+	memcpy(&ps->list[k], p->list, sizeof(token) * count);
+	for(int j = k + count; j < len; j++)
+	{
+		ps->list[j].start += delta;
+	}
+	ps->listLen = len;
+	ps->comment = comment;
+	ps->bad = bad;
+
+	for(int j = 0; j < k; j++) //drop subtrees that looked at token k or later
+	{
+		for(Node **np = &ps->list[j].nodes; *np != NULL; )
+		{
+			if(j + (*np)->len >= k)
+			{
+				*np = (*np)->next;
+			}
+			else
+			{
+				np = &(*np)->next;
+			}
+		}
+	}
+}
+
+// Build the tree for the tokens of PS with P, reusing kept subtrees; HERE
+// documents are not read (see reparse())
+static CMD *buildTree(Parser *p, Parse *ps)
+{
+	if(checkLine(ps->bad, ps->listLen, ps->leftPar, ps->rightPar) <= 0)
+	{
+		return NULL;
+	}
+
+	token *list = p->list; //the parser's own list, to put back
+	char *buf = p->buf;
+	size_t bufLen = p->bufLen;
+	size_t *bufPos = p->bufPos;
+	size_t pos = 0;
+
+	p->list = ps->list;
+	p->listLen = ps->listLen;
+	p->listIndex = 0;
+	p->error = 0;
+	p->keep = true;
+	p->buf = ps->text; //an empty buffer for HERE documents
+	p->bufLen = 0;
+	p->bufPos = &pos;
+
+	int phase = statsPhase(PHASE_PARSE);
+	CMD *tree = makeCMD(p);
+	statsPhase(phase);
+	if(p->error == ERROR)
+	{
+		tree = NULL;
+	}
+
+	p->list = list;
+	p->keep = false;
+	p->buf = buf;
+	p->bufLen = bufLen;
+	p->bufPos = bufPos;
+	return tree;
+}
+
+Parse *mallocParse (Parser *p, const char *line, size_t len)
+{
+	Parse *ps = malloc(sizeof(*ps));
+
+	ps->size = 256;
+	ps->text = malloc(ps->size);
+	ps->text[0] = '\0';
+	ps->len = 0;
+	ps->listSize = 64;
+	ps->list = malloc(sizeof(token) * ps->listSize);
+	ps->listLen = 0;
+	ps->comment = 0;
+	ps->bad = false;
+	ps->leftPar = 0;
+	ps->rightPar = 0;
+	ps->arena = mallocArena();
+	ps->arenaBase = 0;
+	ps->tree = NULL;
+
+	reparse(p, ps, 0, 0, line, len);
+	return ps;
+}
+
+CMD *reparse (Parser *p, Parse *ps, size_t off, size_t delLen,
+              const char *ins, size_t insLen)
+{
+	if(off > (size_t) ps->len)
+	{
+		off = ps->len;
+	}
+	if(delLen > ps->len - off)
+	{
+		delLen = ps->len - off;
+	}
+
+	int len = ps->len - delLen + insLen;
+	if(len + 1 > ps->size)
+	{
+		while(len + 1 > ps->size)
+		{
+			ps->size *= 2;
+		}
+		ps->text = realloc(ps->text, ps->size);
+		STATS_ALLOC(ps->size);
+	}
+	memmove(ps->text + off + insLen, ps->text + off + delLen, ps->len - off - delLen + 1);
+	memcpy(ps->text + off, ins, insLen);
+	ps->len = len;
+
+	Arena *arena = p->arena; //none unless a command is pending
+	bool cont = p->cont;
+	p->arena = ps->arena;
+	p->cont = false; //the text is one line
+
+	if(arenaSize(ps->arena) > 4 * ps->arenaBase) //mostly garbage: start over
+	{
+		ps->arena = freeArena(ps->arena);
+		p->arena = ps->arena = mallocArena();
+		ps->listLen = 0;
+		ps->leftPar = 0;
+		ps->rightPar = 0;
+		ps->comment = ps->len;
+		ps->bad = false;
+		relex(p, ps, 0, 0, ps->len);
+		ps->tree = buildTree(p, ps);
+		ps->arenaBase = arenaSize(ps->arena);
+	}
+	else
+	{
+		relex(p, ps, off, delLen, insLen);
+		ps->tree = buildTree(p, ps);
+	}
+
+	p->arena = arena;
+	p->cont = cont;
+	return ps->tree;
+}
+
+CMD *parseTree (Parse *ps)
+{
+	return ps->tree;
+}
+
+const char *parseText (Parse *ps)
+{
+	return ps->text;
+}
+
+Parse *freeParse (Parse *ps)
+{
+	if(ps)
+	{
+		freeArena(ps->arena);
+		free(ps->text);
+		free(ps->list);
+		free(ps);
+	}
+	return NULL;
+}
+
+// If ITEM is a local (NAME=VALUE), set *NAME and *VALUE to its two halves
+// and return true; the lexer has already found the = (see token.eq)
+bool isLocal(Parser *p, token* item, char **NAME, char **VALUE)
+{
+	if(item->type != TEXT || item->eq < 0) //not NAME=VALUE
+	{
+		return false;
+	}
+
+	if(item->text) //unescaped copy: VALUE is its tail
+	{
+		*NAME = arenaStrndup(p->arena, item->text, item->eq);
+		*VALUE = &item->text[item->eq+1];
+	}
+	else //span: one copy, split at the =
+	{
+		*NAME = arenaStrndup(p->arena, &p->input[item->start], item->len);
+		(*NAME)[item->eq] = '\0';
+		*VALUE = &(*NAME)[item->eq+1];
 	}
+	return true;
 }
 
-bool isRedirect(token **list)
+bool isRedirect(Parser *p)
 {
-	if(RED_OP(list[listIndex]->type)) //redirection symbol
+	if(RED_OP(p->list[p->listIndex].type)) //redirection symbol
 	{
-		if((listIndex + 1 < listLen) && (list[listIndex+1]->type == TEXT)) //valid filename
+		if((p->listIndex + 1 < p->listLen) && (p->list[p->listIndex+1].type == TEXT)) //valid filename
 		{
 			return true;
 		}
 		else
 		{
-			error = ERROR; //invalid filename
+			p->error = ERROR; //invalid filename
 			fprintf(stderr, "parsley: improper filename\n");
 			return false;
 		}
@@ -491,977 +1349,703 @@ bool isRedirect(token **list)
 	}
 }
 
-CMD *makeSimple(token **list)
+// Set slot I of the words of P (see keepWords()) to WORD, doubling the
+// words first if they are too few
+static void setWord(Parser *p, int i, char *word)
 {
-	CMD *tree = mallocCMD(SIMPLE, NULL, NULL);
+	if(i >= p->wordsSize)
+	{
+		p->wordsSize *= 2;
+		p->words = realloc(p->words, sizeof(char*) * p->wordsSize);
+		STATS_ALLOC(sizeof(char*) * p->wordsSize);
+	}
+	p->words[i] = word;
+}
+
+// Return a NULL-terminated array from the arena of P holding words FROM,
+// FROM+STEP, ... of P, N in all.  The locals (as NAME, VALUE pairs) and then
+// the argv of a [stage] are gathered in the words, which are kept from stage
+// to stage, so that each array in the tree is just as long as it needs to be.
+static char **keepWords(Parser *p, int from, int n, int step)
+{
+	char **list = arenaAlloc(p->arena, sizeof(char*) * (n+1));
 
-	//check if current token in list is part of
-	//a prefix
+	for(int i = 0; i < n; i++)
+	{
+		list[i] = p->words[from + i*step];
+	}
+	list[n] = NULL;
 
-	char *NAME = NULL;
-	char *VALUE = NULL;
+	return list;
+}
 
-	char **variables = malloc(sizeof(char*)*(listLen+1));
-	char **varValues = malloc(sizeof(char*)*(listLen+1));
-	int locals = 0;
+#define IO_IN 1 //a [stage] redirects stdin
+#define IO_OUT 2 //a [stage] redirects stdout
 
-	while(listIndex < listLen && (isLocal(list[listIndex], &NAME, &VALUE) || isRedirect(list))) //subsequent tokens
+// Return the text of token T and set *LEN to its length, without copying it:
+// a span of the line, or the unescaped copy of an escaped TEXT token
+static const char *tokenSpan(Parser *p, token *t, size_t *len)
+{
+	if(t->text != NULL)
 	{
-		if(!RED_OP(list[listIndex]->type)) //local
-		{
-			locals++;
+		*len = strlen(t->text);
+		return t->text;
+	}
+	*len = t->len;
+	return &p->input[t->start];
+}
 
-			variables[locals-1] = NAME;
-			varValues[locals-1] = VALUE;
+// Return the redirections (IO_IN, IO_OUT) that TREE already has
+static int ioOf(CMD *tree)
+{
+	return (tree->fromType != NONE ? IO_IN : 0) | (tree->toType != NONE ? IO_OUT : 0);
+}
 
-			listIndex++;
+// Consume the redirection at the current token of P (which isRedirect()) and
+// its filename: add it to TREE, or if TREE is NULL report it to the callbacks
+// of P.  *IO holds the redirections already in its [stage].  Return false on
+// error.
+static bool takeRedirect(Parser *p, CMD *tree, int *io)
+{
+	int type = p->list[p->listIndex].type;
+	token *file = &p->list[p->listIndex+1];
+	int side = 0;
+
+	if(type == RED_IN || type == RED_IN_HERE)
+	{
+		side = IO_IN;
+	}
+	else if(type == RED_OUT || type == RED_OUT_APP)
+	{
+		side = IO_OUT;
+	}
+	else //2>, 2>>, and &> are not supported
+	{
+		p->error = ERROR;
+		fprintf(stderr, "parsley: redirect symbol not found\n");
+		return false;
+	}
+
+	if(*io & side)
+	{
+		p->error = ERROR;
+		fprintf(stderr, side == IO_IN ? "parsley: multiple input redirects\n"
+		                              : "parsley: multiple output redirects\n");
+		return false;
+	}
+	*io |= side;
+
+	if(tree != NULL)
+	{
+		if(side == IO_OUT)
+		{
+			tree->toType = type;
+			tree->toFile = tokenText(p, file);
 		}
-		else
+		else if(type == RED_IN)
 		{
-			if(error == 0) //no error
-			{
-				if(list[listIndex]->type == RED_IN) //set attributes of tree
-				{
-					if(tree->fromType != NONE)
-					{
-						error = ERROR;
-						fprintf(stderr, "parsley: multiple input redirects\n");
-
-						for(int f = 0; f < locals; f++)
-						{
-							free(variables[f]);
-							free(varValues[f]);
-						}
-
-						free(variables);
-						free(varValues);
-						return freeCMD(tree);
-					}
-					else
-					{
-						tree->fromType = RED_IN;
-						tree->fromFile = list[listIndex+1]->text;
-					}
-				}
-				else if(list[listIndex]->type == RED_OUT) 
-				{
-					if(tree->toType != NONE)
-					{
-						error = ERROR;
-						fprintf(stderr, "parsley: multiple output redirects\n");
-						
-						for(int f = 0; f < locals; f++)
-						{
-							free(variables[f]);
-							free(varValues[f]);
-						}
-
-						free(variables);
-						free(varValues);
-						
-						return freeCMD(tree);
-					}
-					else
-					{
-						tree->toType = RED_OUT;
-						tree->toFile = list[listIndex+1]->text;
-					}
-				}
-				else if(list[listIndex]->type == RED_OUT_APP) 
-				{
-					if(tree->toType != NONE)
-					{
-						error = ERROR;
-						fprintf(stderr, "parsley: multiple output redirects\n");
-
-						
-						for(int f = 0; f < locals; f++)
-						{
-							free(variables[f]);
-							free(varValues[f]);
-						}
-
-						free(variables);
-						free(varValues);
-						
-						return freeCMD(tree);
-					}
-					else
-					{
-						tree->toType = RED_OUT_APP;
-						tree->toFile = list[listIndex+1]->text;
-					}
-				}
-				else if(list[listIndex]->type == RED_IN_HERE) //set attributes of tree; HERE
-				{
-					if(tree->fromType != NONE)
-					{
-						error = ERROR;
-						fprintf(stderr, "parsley: multiple input redirects\n");
-
-						
-						for(int f = 0; f < locals; f++)
-						{
-							free(variables[f]);
-							free(varValues[f]);
-						}
-
-						free(variables);
-						free(varValues);
-						
-						return freeCMD(tree);
-					}
-					else
-					{
-						tree->fromType = RED_IN_HERE;
-
-						char *line = NULL;                         
-						size_t nLine = 0;  
-
-						int hereInputLen = strlen(list[listIndex+1]->text);
-
-						char *hereInput = malloc(sizeof(char*)*(hereInputLen+2));
-
-						strcpy(hereInput, list[listIndex+1]->text);
-						hereInput[hereInputLen] = '\n';
-						hereInput[hereInputLen+1] = '\0';
-
-						char *s = malloc(sizeof(char));
-						char* temp;
-						s[0] = '\0';
-
-						while(getline (&line,&nLine, stdin) > 0) // getline failed
-						{
-							if(strcmp(line, hereInput) == 0)
-							{
-								break;
-							}	
-							
-							temp = malloc((strlen(line)+strlen(s)+2)*sizeof(char)); 
-							strcpy(temp, s);
-
-							strcat(temp, line);
-							free(s);
-
-							s = temp;
-						}
-
-						tree->fromFile = s;
-						free(line);
-						free(hereInput);
-					}
-				}
-				else
-				{
-					error = ERROR;
-					printf("redirect symbol not found\n");
-					exit(0);
-				}
-				listIndex = listIndex + 2; //consume the redirection and filename
+			tree->fromType = type;
+			tree->fromFile = tokenText(p, file);
+		}
+		else
+		{
+			tree->fromType = type;
+			if(!readHere(p, file, tree))
+			{
+				return false;
 			}
 		}
 	}
-
-	//next token should be TEXT, if not, then this is not a simple
-
-	if(listIndex >= listLen)
+	else
 	{
-		error = ERROR;
-		fprintf(stderr, "parsley: NULL command\n");
-		
-		for(int f = 0; f < locals; f++)
+		const char *text; //filename, or contents of HERE document
+		size_t len;
+		int fd = -1;
+
+		if(type == RED_IN_HERE) //read it even if no one is listening, so that
+		{                       //the next line is the one after it
+			CMD doc = {.fromType = NONE, .fromFd = -1};
+			if(!readHere(p, file, &doc))
+			{
+				return false;
+			}
+			text = doc.fromFile;
+			len = text ? strlen(text) : doc.fromLen;
+			fd = doc.fromFd;
+		}
+		else
+		{
+			text = tokenSpan(p, file, &len);
+		}
+		if(p->ev->redirect)
 		{
-			free(variables[f]);
-			free(varValues[f]);
+			p->ev->redirect(p->evCtx, type, text, len, fd);
 		}
+	}
+	p->listIndex = p->listIndex + 2; //consume the redirection and filename
+	return true;
+}
+
+// Consume the [stage] at the current token of P, through the ( that starts
+// it if it is a [subcmd], and set *IO to its redirections.  Its locals, argv,
+// and redirections go into TREE (which becomes a SUBCMD for a [subcmd]), or
+// if TREE is NULL to the callbacks of P (with endStage after a [simple]).  The
+// [prefix] is the same for both kinds, so it is read once, and the token after
+// it decides which.  Return SIMPLE, SUBCMD, or ERROR.
+static int takeStage(Parser *p, CMD *tree, int *io)
+{
+	const ParseEvents *ev = p->ev; //only if TREE is NULL
+	int locals = 0; //#locals in the [prefix]
+	int numArgs = 0;
 
-		free(variables);
-		free(varValues);
-		return freeCMD(tree);
-	}		
+	*io = 0;
+	if(tree == NULL && ev->beginStage)
+	{
+		ev->beginStage(p->evCtx);
+	}
 
-	if(listIndex < listLen && list[listIndex]->type == TEXT)
+	while(p->listIndex < p->listLen && ((p->list[p->listIndex].type == TEXT && p->list[p->listIndex].eq >= 0) || isRedirect(p))) //PREFIX
 	{
-		int numArgs = 1;
-		char **args = malloc(sizeof(char*)*(listLen+1)); //max number of args
-		args[numArgs-1] = list[listIndex]->text; //consume token
-		
-		listIndex++;
+		token *item = &p->list[p->listIndex];
 
-		while(listIndex < listLen && ((list[listIndex]->type == TEXT) || isRedirect(list)))  //subsequent tokens suffix
+		if(RED_OP(item->type))
 		{
-			if(!RED_OP(list[listIndex]->type))
-			{
-				numArgs++;
-				args[numArgs-1] = list[listIndex]->text;
-				listIndex++;
-			}
-			else
+			if(!takeRedirect(p, tree, io))
 			{
-				if(error == 0) //no error
-				{
-					if(list[listIndex]->type == RED_IN) //set attributes of tree
-					{
-						if(tree->fromType != NONE)
-						{
-							error = ERROR;
-							fprintf(stderr, "parsley: multiple input redirects\n");
-							
-							for(int f = 0; f < locals; f++)
-							{
-								free(variables[f]);
-								free(varValues[f]);
-							}
-
-							free(variables);
-							free(varValues);
-							
-							for(int a = 0; a < numArgs; a++)
-							{
-								free(args[a]);
-							}
-
-							free(args);
-
-							return freeCMD(tree);
-						}
-						else
-						{
-							tree->fromType = RED_IN;
-							tree->fromFile = list[listIndex+1]->text;
-						}
-					}
-					else if(list[listIndex]->type == RED_OUT) 
-					{
-						if(tree->toType != NONE)
-						{
-							error = ERROR;
-							fprintf(stderr, "parsley: multiple output redirects\n");
-							for(int f = 0; f < locals; f++)
-							{
-								free(variables[f]);
-								free(varValues[f]);
-							}
-
-							free(variables);
-							free(varValues);
-							
-							for(int a = 0; a < numArgs; a++)
-							{
-								free(args[a]);
-							}
-
-							free(args);
-							return freeCMD(tree);
-						}
-						else
-						{
-							tree->toType = RED_OUT;
-							tree->toFile = list[listIndex+1]->text;
-						}
-					}
-					else if(list[listIndex]->type == RED_OUT_APP) 
-					{
-						if(tree->toType != NONE)
-						{
-							error = ERROR;
-							fprintf(stderr, "parsley: multiple output redirects\n");
-
-							for(int f = 0; f < locals; f++)
-							{
-								free(variables[f]);
-								free(varValues[f]);
-							}
-
-							free(variables);
-							free(varValues);
-							
-							for(int a = 0; a < numArgs; a++)
-							{
-								free(args[a]);
-							}
-
-							free(args);
-							return freeCMD(tree);
-						}
-						else
-						{
-							tree->toType = RED_OUT_APP;
-							tree->toFile = list[listIndex+1]->text;
-						}
-					}
-					else if(list[listIndex]->type == RED_IN_HERE) //set attributes of tree; HERE
-					{
-
-						if(tree->fromType != NONE)
-						{
-							error = ERROR;
-							fprintf(stderr, "parsley: multiple input redirects\n");
-
-							for(int f = 0; f < locals; f++)
-							{
-								free(variables[f]);
-								free(varValues[f]);
-							}
-
-							free(variables);
-							free(varValues);
-							
-							for(int a = 0; a < numArgs; a++)
-							{
-								free(args[a]);
-							}
-
-							free(args);
-							return freeCMD(tree);
-						}
-						else
-						{
-							tree->fromType = RED_IN_HERE;
-
-							char *line = NULL;                         
-							size_t nLine = 0;  
-
-							int hereInputLen = strlen(list[listIndex+1]->text);
-
-							char *hereInput = malloc(sizeof(char*)*(hereInputLen+2));
-
-							strcpy(hereInput, list[listIndex+1]->text);
-							hereInput[hereInputLen] = '\n';
-							hereInput[hereInputLen+1] = '\0';
-
-							char *s = malloc(sizeof(char));
-							char* temp;
-							s[0] = '\0';
-
-						while(getline (&line,&nLine, stdin) > 0) // getline failed
-						{
-							if(strcmp(line, hereInput) == 0)
-							{
-								break;
-							}	
-							
-							temp = malloc((strlen(line)+strlen(s)+2)*sizeof(char)); 
-							strcpy(temp, s);
-
-							strcat(temp, line);
-							free(s);
-							s = temp;
-						}
-
-						tree->fromFile = s;
-						free(line);
-						free(hereInput);
-					}
-				}
-				else
-				{
-					error = ERROR;
-					printf("redirect symbol not found\n");
-					exit(0);
-				}
-					listIndex = listIndex + 2; //consume the redirection and filename
-				}
+				return ERROR;
 			}
+			continue;
 		}
 
-		args[numArgs] = '\0';
-		free(tree->argv);
-		tree->argv = args;
-		tree->argc = numArgs;
-
-		if(locals > 0)
+		if(tree != NULL) //local: NAME and VALUE go in the words
 		{
-			variables[locals] = '\0';
-			varValues[locals] = '\0';
+			char *NAME;
+			char *VALUE;
 
-			tree->locVar = variables;
-			tree->locVal = varValues;
-			tree->nLocal = locals;
+			isLocal(p, item, &NAME, &VALUE);
+			locals++;
+			setWord(p, 2*locals-2, NAME);
+			setWord(p, 2*locals-1, VALUE);
 		}
-		else
+		else if(ev->local) //local: NAME and VALUE are the two halves of its text
 		{
-			for(int f = 0; f < locals; f++)
-			{
-				free(variables[f]);
-				free(varValues[f]);
-			}
-
-			free(variables);
-			free(varValues);
-
+			size_t len;
+			const char *text = tokenSpan(p, item, &len);
 
+			ev->local(p->evCtx, text, item->eq, &text[item->eq+1], len - item->eq - 1);
 		}
-
-		return tree;
-
+		p->listIndex++;
 	}
 
-	for(int f = 0; f < locals; f++)
+	if(p->error != 0) //improper filename
 	{
-		free(variables[f]);
-		free(varValues[f]);
+		return ERROR;
 	}
 
-	free(variables);
-	free(varValues);
-	if(error == 0 && tree == NULL)
+	if(p->listIndex >= p->listLen)
 	{
-		return freeCMD(tree);
+		p->error = ERROR;
+		fprintf(stderr, "parsley: NULL command\n");
+		return ERROR;
 	}
-	else
+
+	int kind = SIMPLE;
+
+	if(p->list[p->listIndex].type == PAR_LEFT) //subcmd
 	{
-		return NULL; //not able to make simple
+		kind = SUBCMD;
+		if(tree != NULL)
+		{
+			tree->type = SUBCMD;
+		}
+		else if(ev->openSubcmd)
+		{
+			ev->openSubcmd(p->evCtx);
+		}
+		p->listIndex++; //makeCMD() or emitCMD() goes on with the command inside
 	}
-}
-
-CMD *makeStage(token **list)
-{
-	int save = listIndex;
-	CMD *tree = makeSimple(list);
-	if(tree != NULL)
+	else if(p->list[p->listIndex].type != TEXT) //not a command
 	{
-		return tree;
+		p->error = ERROR;
+		fprintf(stderr, "parsley: Unable to make simple or subcmd\n");
+		return ERROR;
 	}
-	else //make subcmd CMD or error
+	else //simple
 	{
-		if(error != 0)
+		while(p->listIndex < p->listLen && ((p->list[p->listIndex].type == TEXT) || isRedirect(p))) //argv and suffix
 		{
-			return freeCMD(tree);
-		}
-		else
-		{
-		//check if current token in list is part of
-		//a prefix
-
-			listIndex = save;
+			token *item = &p->list[p->listIndex];
 
-			tree = mallocCMD(SUBCMD, NULL, NULL);
-
-			char *NAME = NULL;
-			char *VALUE = NULL;
-
-			char **variables = malloc(sizeof(char*)*(listLen+1));
-			char **varValues = malloc(sizeof(char*)*(listLen+1));
-			int locals = 0;
-
-			while(listIndex < listLen && (isLocal(list[listIndex], &NAME, &VALUE) || isRedirect(list))) //PREFIX
+			if(RED_OP(item->type))
 			{
-				if(!RED_OP(list[listIndex]->type)) //local
-				{
-					locals++;
-
-					variables[locals-1] = NAME;
-					varValues[locals-1] = VALUE;
-
-					listIndex++;
-				}
-				else
+				if(!takeRedirect(p, tree, io))
 				{
-					if(error == 0) //no error
-					{
-						if(list[listIndex]->type == RED_IN) //set attributes of tree
-						{
-							if(tree->fromType != NONE)
-							{
-								error = ERROR;
-								fprintf(stderr, "parsley: multiple input redirects\n");
-
-								free(variables);
-								free(varValues);
-								return freeCMD(tree);
-							}
-							else
-							{
-								tree->fromType = RED_IN;
-								tree->fromFile = list[listIndex+1]->text;
-							}
-						}
-						else if(list[listIndex]->type == RED_OUT) 
-						{	
-							if(tree->toType != NONE)
-							{
-								error = ERROR;
-								fprintf(stderr, "parsley: multiple output redirects\n");
-
-								
-								free(variables);
-								free(varValues);
-
-								return freeCMD(tree);
-							}
-							else
-							{
-								tree->toType = RED_OUT;
-								tree->toFile = list[listIndex+1]->text;
-							}
-						}
-						else if(list[listIndex]->type == RED_OUT_APP) 
-						{
-							if(tree->toType != NONE)
-							{
-								error = ERROR;
-								fprintf(stderr, "parsley: multiple output redirects\n");
-
-								
-								free(variables);
-								free(varValues);
-								
-								return freeCMD(tree);
-							}
-							else
-							{
-								tree->toType = RED_OUT_APP;
-								tree->toFile = list[listIndex+1]->text;
-							}
-						}
-						else if(list[listIndex]->type == RED_IN_HERE) //set attributes of tree; HERE
-						{
-							if(tree->fromType != NONE)
-							{
-								error = ERROR;
-								fprintf(stderr, "parsley: multiple input redirects\n");
-
-								
-								free(variables);
-								free(varValues);
-								
-								return freeCMD(tree);
-							}
-							else
-							{
-								tree->fromType = RED_IN_HERE;
-
-								char *line = NULL;                         
-								size_t nLine = 0;  
-
-								int hereInputLen = strlen(list[listIndex+1]->text);
-
-								char *hereInput = malloc(sizeof(char*)*(hereInputLen+2));
-
-								strcpy(hereInput, list[listIndex+1]->text);
-								hereInput[hereInputLen] = '\n';
-								hereInput[hereInputLen+1] = '\0';
-
-								char *s = malloc(sizeof(char));
-								char* temp;
-								s[0] = '\0';
-
-						while(getline (&line,&nLine, stdin) > 0) // getline failed
-						{
-							if(strcmp(line, hereInput) == 0)
-							{
-								break;
-							}	
-							
-							temp = malloc((strlen(line)+strlen(s)+2)*sizeof(char)); 
-							strcpy(temp, s);
-
-							strcat(temp, line);
-							free(s);
-
-							s = temp;
-						}
-
-						tree->fromFile = s;
-						free(line);
-						free(hereInput);
-					}
+					return ERROR;
 				}
-				else
-				{
-					error = ERROR;
-					printf("redirect symbol not found\n");
-					exit(0);
-				}
-				listIndex = listIndex + 2; //consume the redirection and filename
+				continue;
 			}
-		}
-	}
-
-			//next token should be ()
-
-	if(listIndex >= listLen)
-	{
-		error = ERROR;
-		fprintf(stderr, "parsley: NULL command\n");
-
-		free(variables);
-		free(varValues);
-		return freeCMD(tree);
-	}		
-
-			//printf("1%s\n", list[listIndex]->text);
-
 
-
-			if(listIndex < listLen && list[listIndex]->type == PAR_LEFT) //command
+			if(tree != NULL)
 			{
-				listIndex++;
-
-				CMD *tree2 = makeCMD(list);
-
-				if((error == ERROR) || list[listIndex]->type != PAR_RIGHT)
-				{
-					free(tree2);
-					return freeCMD(tree);
-				}
-				else
-				{
-					listIndex++;
-					tree->left = tree2;
-					tree->right = NULL;
-					
-				}
+				setWord(p, 2*locals + numArgs, tokenText(p, item));
 			}
-			else if(list[listIndex]->type != PAR_RIGHT) //not a command
+			else if(ev->arg)
 			{
-				error = ERROR;
-				fprintf(stderr, "parsley: Unable to make simple or subcmd\n");
-				free(variables);
-				free(varValues);
-				return freeCMD(tree);
+				size_t len;
+				const char *text = tokenSpan(p, item, &len);
+
+				ev->arg(p->evCtx, text, len);
 			}
+			numArgs++;
+			p->listIndex++;
+		}
 
-			//redList
-			while(listIndex < listLen && isRedirect(list)) //subsequent tokens
-			{
+		if(p->error != 0) //improper filename
+		{
+			return ERROR;
+		}
+		if(tree != NULL)
+		{
+			tree->argv = keepWords(p, 2*locals, numArgs, 1);
+			tree->argc = numArgs;
+		}
+		else if(ev->endStage)
+		{
+			ev->endStage(p->evCtx);
+		}
+	}
 
-				if(error == 0) //no error
-				{
+	if(tree != NULL && locals > 0)
+	{
+		tree->locVar = keepWords(p, 0, locals, 2);
+		tree->locVal = keepWords(p, 1, locals, 2);
+		tree->nLocal = locals;
+	}
+	return kind;
+}
 
-						if(list[listIndex]->type == RED_IN) //set attributes of tree
-						{
-
-							if(tree->fromType != NONE)
-							{
-								error = ERROR;
-								fprintf(stderr, "parsley: multiple input redirects\n");
-								
-								free(variables);
-								free(varValues);
-								return freeCMD(tree);
-							}
-							else
-							{
-								tree->fromType = RED_IN;
-								tree->fromFile = list[listIndex+1]->text;
-							}
-						}
-						else if(list[listIndex]->type == RED_OUT) 
-						{	
-							if(tree->toType != NONE)
-							{
-								error = ERROR;
-								fprintf(stderr, "parsley: multiple output redirects\n");
-
-								
-								free(variables);
-								free(varValues);
-								
-								return freeCMD(tree);
-							}
-							else
-							{
-								tree->toType = RED_OUT;
-								tree->toFile = list[listIndex+1]->text;
-							}
-						}
-						else if(list[listIndex]->type == RED_OUT_APP) 
-						{
-							if(tree->toType != NONE)
-							{
-								error = ERROR;
-								fprintf(stderr, "parsley: multiple output redirects\n");
-
-
-								free(variables);
-								free(varValues);
-
-								return freeCMD(tree);
-							}
-							else
-							{
-								tree->toType = RED_OUT_APP;
-								tree->toFile = list[listIndex+1]->text;
-							}
-						}
-						else if(list[listIndex]->type == RED_IN_HERE) //set attributes of tree; HERE
-						{
-							if(tree->fromType != NONE)
-							{
-								error = ERROR;
-								fprintf(stderr, "parsley: multiple input redirects\n");
-
-								
-								free(variables);
-								free(varValues);
-
-								return freeCMD(tree);
-							}
-							else
-							{
-								tree->fromType = RED_IN_HERE;
-
-								char *line = NULL;                         
-								size_t nLine = 0;  
-
-								int hereInputLen = strlen(list[listIndex+1]->text);
-
-								char *hereInput = malloc(sizeof(char*)*(hereInputLen+2));
-
-								strcpy(hereInput, list[listIndex+1]->text);
-								hereInput[hereInputLen] = '\n';
-								hereInput[hereInputLen+1] = '\0';
-
-								char *s = malloc(sizeof(char));
-								char* temp;
-								s[0] = '\0';
-
-						while(getline (&line,&nLine, stdin) > 0) // getline failed
-						{
-							if(strcmp(line, hereInput) == 0)
-							{
-								break;
-							}	
-							
-							temp = malloc((strlen(line)+strlen(s)+2)*sizeof(char)); 
-							strcpy(temp, s);
-
-							strcat(temp, line);
-							free(s);
-
-							s = temp;
-						}
-
-						tree->fromFile = s;
-						free(line);
-						free(hereInput);
-
-					}
-				}
-				else
-				{
-					error = ERROR;
-					printf("redirect symbol not found\n");
-					exit(0);
-				}
-						listIndex = listIndex + 2; //consume the redirection and filename
-					}
-				}
+// Build the tree for the [stage] at the current token of P: for a [simple],
+// its SIMPLE; for a [subcmd], a SUBCMD with the [prefix] but not yet the
+// [command] (see makeCMD()), past the ( that starts it
+CMD *makeStage(Parser *p)
+{
+	CMD *tree = arenaCMD(p, SIMPLE, NULL, NULL);
+	int io;
 
-				if(listIndex < listLen && 
-					((list[listIndex]->type == PAR_LEFT) || list[listIndex]->type == TEXT))
-				{
-					error = ERROR;
-					fprintf(stderr, "parsley: invalid following subcmd\n");
+	return (takeStage(p, tree, &io) == ERROR) ? NULL : tree;
+}
 
-					free(variables); //no locals, don't use malloced memory
-					free(varValues);
-					return freeCMD(tree);
-				}
-				else
-				{
-					if(locals > 0)
-					{
-						variables[locals] = '\0';
-						varValues[locals] = '\0';
-
-						tree->locVar = variables;
-						tree->locVal = varValues;
-						tree->nLocal = locals;
-					}
-					else
-					{
-					free(variables); //no locals, don't use malloced memory
-					free(varValues);
-				}
-				return tree;
-			}
+// Finish a [subcmd] once the command inside its ( ) has been parsed and the )
+// consumed: consume the [redList] after the ), given the redirections IO of
+// its [prefix].  It goes into the SUBCMD TREE, or if TREE is NULL to the
+// callbacks of P (followed by endStage).  Return false on error.
+static bool endSubcmd(Parser *p, CMD *tree, int io)
+{
+	while(p->listIndex < p->listLen && isRedirect(p)) //redList
+	{
+		if(!takeRedirect(p, tree, &io))
+		{
+			return false;
 		}
+	}
 
+	if(p->error == ERROR) //improper filename
+	{
+		return false;
+	}
+	if(p->listIndex < p->listLen && 
+		((p->list[p->listIndex].type == PAR_LEFT) || p->list[p->listIndex].type == TEXT))
+	{
+		p->error = ERROR;
+		fprintf(stderr, "parsley: invalid following subcmd\n");
+		return false;
+	}
+	if(tree == NULL && p->ev->endStage)
+	{
+		p->ev->endStage(p->evCtx);
 	}
+	return true;
 }
 
-CMD *makePipeline(token **list)
+// Return true if the current token of P ends a [command]: the end of the
+// line, or a )
+static bool atEnd(Parser *p)
 {
-	CMD *tree;
-	tree = makeStage(list);
+	return p->listIndex >= p->listLen || p->list[p->listIndex].type == PAR_RIGHT;
+}
 
-	if(error == ERROR || tree == NULL)
+// Return true if an operand (a [stage]) can start at the current token of P,
+// after operator AFTER (PAR_LEFT at the start of a [command]); else report
+// why not.  The stack of P is empty only at the start of the line.
+static bool haveOperand(Parser *p, int after)
+{
+	if(!atEnd(p))
 	{
-		return freeCMD(tree);
+		return true;
 	}
 
-	while(listIndex < listLen && ((tree != NULL) && (list[listIndex]->type == PIPE)))
+	p->error = ERROR;
+	if(p->listIndex < p->listLen && after == PAR_LEFT && p->stackLen == 0)
 	{
-		listIndex++;
-
-		if(listIndex >= listLen)
-		{
-			error = ERROR;
-			fprintf(stderr, "parsley: NULL command pipe\n");
-			return freeCMD(tree);
-		}		
-
-		CMD *tree2 = makeStage(list);
+		fprintf(stderr, "parse: uneven parans\n");
+	}
+	else if(after == PIPE)
+	{
+		fprintf(stderr, "parsley: NULL command pipe\n");
+	}
+	else if(after == SEP_AND || after == SEP_OR)
+	{
+		fprintf(stderr, "parsley: NULL command andor\n");
+	}
+	else
+	{
+		fprintf(stderr, "parsley: NULL command\n");
+	}
+	return false;
+}
 
-		if(error == ERROR || tree2 == NULL)
+// Return what follows an operand at the current token of P when OPEN ( are
+// still open: NONE at the end of the line, PAR_RIGHT, or an operator (PIPE,
+// ..., SEP_BG); or ERROR (after reporting it) if nothing valid does
+static int nextOperator(Parser *p, int open)
+{
+	if(p->listIndex >= p->listLen) //end of the [command]
+	{
+		if(open > 0)
 		{
-			freeCMD(tree2);
-			return freeCMD(tree);
+			p->error = ERROR;
+			fprintf(stderr, "parse: uneven parans\n");
+			return ERROR;
 		}
-		else
-		{
-			CMD *treeBig = mallocCMD(PIPE, NULL, NULL);
+		return NONE;
+	}
 
-			treeBig->left = tree;
-			treeBig->right = tree2;
+	int type = p->list[p->listIndex].type;
 
-			tree = treeBig;
-		}
+	if(type == PAR_RIGHT && open == 0)
+	{
+		p->error = ERROR;
+		fprintf(stderr, "parse: uneven parans\n");
+		return ERROR;
 	}
-	return tree;
+	if(type != PAR_RIGHT && opPrec[type] == 0) //not an operator
+	{
+		p->error = ERROR;
+		fprintf(stderr, "parsley: invalid following simple\n");
+		return ERROR;
+	}
+	return type;
 }
 
-CMD *makeAndOr(token **list)
+// Push a frame for operator OP (NONE for an operand), START, and TREE onto the
+// stack of P, doubling the stack first if it is full
+static void push(Parser *p, int op, int start, CMD *tree)
 {
-	CMD *tree = makePipeline(list);
-
-	if(error == ERROR || tree == NULL)
+	if(p->stackLen == p->stackSize)
 	{
-		return freeCMD(tree);
+		p->stackSize *= 2;
+		p->stack = realloc(p->stack, sizeof(Frame) * p->stackSize);
+		STATS_ALLOC(sizeof(Frame) * p->stackSize);
 	}
+	p->stack[p->stackLen++] = (Frame){op, start, tree};
+}
 
-	while(((tree != NULL) && listIndex < listLen) && 
-		((list[listIndex]->type == SEP_AND) || (list[listIndex]->type == SEP_OR)))
+// Combine the operands on top of the stack of P with the operators between
+// them, from the top down, while the operator below the top operand binds at
+// least as tightly as PREC (> 0, so a ( stops it).  Each tree made is a link
+// of a chain, kept for reparse() as such.
+static void reduce(Parser *p, int prec)
+{
+	while(p->stackLen >= 3 && opPrec[p->stack[p->stackLen-2].op] >= prec)
 	{
-		CMD *treeBig;
+		Frame *left = &p->stack[p->stackLen-3];
+		int op = p->stack[p->stackLen-2].op;
+		CMD *right = p->stack[p->stackLen-1].tree;
 
-		if(list[listIndex]->type == SEP_AND)
+		left->tree = arenaCMD(p, op, left->tree, right);
+		if(op == PIPE)
+		{
+			keepNode(p, NODE_PIPE, left->start, left->tree);
+		}
+		else if(op == SEP_AND || op == SEP_OR)
 		{
-			treeBig = mallocCMD(SEP_AND, NULL, NULL);
+			keepNode(p, NODE_ANDOR, left->start, left->tree);
 		}
 		else
 		{
-			treeBig = mallocCMD(SEP_OR, NULL, NULL);
+			keepNode(p, NODE_SEQUENCE, left->start, left->tree);
 		}
+		p->stackLen -= 2;
+	}
+}
 
-		listIndex++;
+// If an earlier parse kept a subtree that can be the operand after operator
+// AFTER (PAR_LEFT at the start of a [command]) at the current token of P,
+// advance past the largest one and return it; else return NULL.  A
+// [sequence] can only start a [command], an [and-or] can also follow ; or &,
+// and so on down to a [stage], which can follow any operator.
+static CMD *reuseOperand(Parser *p, int after)
+{
+	static const int kinds[] = {NODE_SEQUENCE, NODE_ANDOR, NODE_PIPE, NODE_STAGE};
 
-		if(listIndex >= listLen)
+	if(!p->keep)
+	{
+		return NULL;
+	}
+	for(int i = opPrec[after]; i < 4; i++)
+	{
+		CMD *tree = reuseNode(p, kinds[i]);
+		if(tree != NULL)
 		{
-			error = ERROR;
-			fprintf(stderr, "parsley: NULL command andor\n");
+			return tree;
+		}
+	}
+	return NULL;
+}
 
-			freeCMD(tree);
-			return freeCMD(treeBig);
-		}	
+// Build the tree for the [command] in the tokens of P.  Instead of recursing
+// on each level of the grammar and on each (, keep the operands and operators
+// not yet combined on an explicit stack and combine them by precedence as
+// each operator or ) arrives, so nesting is bounded only by memory; the
+// trees are the same left-deep ones.
+CMD *makeCMD(Parser *p)
+{
+	int after = PAR_LEFT; //operator before the next operand; PAR_LEFT at the start of a [command]
+	int open = 0; //#( whose ) has not been seen
+	p->stackLen = 0;
 
-		CMD *tree2 = makePipeline(list);
+	for(;;)
+	{
+		//an operand: a [stage], or the ( of a [subcmd]
+		int start = p->listIndex;
+		CMD *tree = reuseOperand(p, after);
 
-		if(error == ERROR || tree2 == NULL)
+		if(tree == NULL)
 		{
-			freeCMD(tree2);
-			return freeCMD(tree);
+			if(!haveOperand(p, after))
+			{
+				return NULL;
+			}
+
+			tree = makeStage(p);
+			if(p->error == ERROR || tree == NULL)
+			{
+				return NULL;
+			}
+			if(tree->type == SUBCMD) //its command comes next
+			{
+				push(p, PAR_LEFT, start, tree);
+				open++;
+				after = PAR_LEFT;
+				continue;
+			}
+			keepNode(p, NODE_STAGE, start, tree);
 		}
-		else
+		push(p, NONE, start, tree);
+
+		//the operators and )s after it, up to the next operand
+		for(;;)
 		{
-			treeBig->left = tree;
-			treeBig->right = tree2;
+			int type = nextOperator(p, open);
+
+			if(type == ERROR)
+			{
+				return NULL;
+			}
+			else if(type == NONE) //end of the [command]
+			{
+				reduce(p, 1);
+				return p->stack[0].tree;
+			}
+			else if(type == PAR_RIGHT) //end of the [command] in a [subcmd]
+			{
+				reduce(p, 1);
+
+				Frame *sub = &p->stack[p->stackLen-2];
+				sub->tree->left = p->stack[p->stackLen-1].tree;
+				p->listIndex++;
+				if(!endSubcmd(p, sub->tree, ioOf(sub->tree)))
+				{
+					return NULL;
+				}
+				keepNode(p, NODE_STAGE, sub->start, sub->tree);
+				sub->op = NONE; //the [subcmd] is now an operand
+				p->stackLen--;
+				open--;
+			}
+			else
+			{
+				reduce(p, opPrec[type]);
+				p->listIndex++;
 
-			tree = treeBig;
+				if(opPrec[type] == 1 && atEnd(p))
+				{
+					//a [sequence] followed by ; or & is a whole [command]
+					Frame *top = &p->stack[p->stackLen-1];
+					top->tree = arenaCMD(p, type, top->tree, NULL);
+				}
+				else
+				{
+					push(p, type, 0, NULL);
+					after = type;
+					break;
+				}
+			}
 		}
 	}
-	return tree;
 }
 
-CMD *makeCMD(token **list)
+// Same as makeCMD(), but report the [command] to the callbacks of P instead
+// of building its tree.  The callbacks see the parts of the command in the
+// order of its tokens, so nothing need be combined by precedence; the stack
+// holds just the redirections (in start) of each [subcmd] whose ( is open.
+// Return false on error.
+static bool emitCMD(Parser *p)
 {
-	CMD *tree2 = makeSequence(list);
-
-	if(error == ERROR || tree2 == NULL)
-	{
-		return freeCMD(tree2);
-	}
+	int after = PAR_LEFT; //operator before the next operand; PAR_LEFT at the start of a [command]
+	p->stackLen = 0;
 
-	if(listIndex < listLen && (list[listIndex]->type == SEP_END || list[listIndex]->type == SEP_BG))
+	for(;;)
 	{
-		CMD *tree;
+		//an operand: a [stage], or the ( of a [subcmd]
+		if(!haveOperand(p, after))
+		{
+			return false;
+		}
 
-		if(list[listIndex]->type == SEP_END)
+		int io;
+		int kind = takeStage(p, NULL, &io);
+		if(kind == ERROR)
 		{
-			tree = mallocCMD(SEP_END, NULL, NULL);
+			return false;
 		}
-		else
+		if(kind == SUBCMD) //its command comes next
 		{
-			tree = mallocCMD(SEP_BG, NULL, NULL);
+			push(p, PAR_LEFT, io, NULL);
+			after = PAR_LEFT;
+			continue;
 		}
 
-		listIndex++;
+		//the operators and )s after it, up to the next operand
+		for(;;)
+		{
+			int type = nextOperator(p, p->stackLen);
 
-		tree->left = tree2;
-		tree->right = NULL;
+			if(type == ERROR)
+			{
+				return false;
+			}
+			else if(type == NONE) //end of the [command]
+			{
+				return true;
+			}
+			else if(type == PAR_RIGHT) //end of the [command] in a [subcmd]
+			{
+				io = p->stack[--p->stackLen].start;
+				p->listIndex++;
+				if(p->ev->closeSubcmd)
+				{
+					p->ev->closeSubcmd(p->evCtx);
+				}
+				if(!endSubcmd(p, NULL, io))
+				{
+					return false;
+				}
+			}
+			else
+			{
+				p->listIndex++;
+				if(p->ev->op)
+				{
+					p->ev->op(p->evCtx, type);
+				}
 
-		return tree;
+				//a [sequence] followed by ; or & is a whole [command]
+				if(opPrec[type] != 1 || !atEnd(p))
+				{
+					after = type;
+					break;
+				}
+			}
+		}
 	}
-	else
+}
+
+// Start on LINE with P for parseEvents() or lex(), which need no tree: the
+// tokens get what storage they need from the scratch arena
+static void useScratch(Parser *p, char *line)
+{
+	if(p->scratch == NULL)
 	{
-		return tree2;
+		p->scratch = mallocArena();
 	}
+	resetArena(p->scratch); //its first block is reused, so a line with
+	p->arena = p->scratch;  //no HERE document allocates nothing
+	p->listLen = 0;
+	p->leftPar = 0;
+	p->rightPar = 0;
+	p->listIndex = 0;
+	p->error = 0;
+	p->input = line;
 }
 
-CMD *makeSequence(token **list)
+int parseEvents (Parser *p, char *line, size_t len, const ParseEvents *ev, void *ctx)
 {
-	CMD *tree = makeAndOr(list);
+	static const ParseEvents none; //no callbacks: just check the syntax
+	uint64_t start = statsCur ? statsNow() : 0;
+	int phase = statsPhase(PHASE_LEX);
 
-	if(error == ERROR || tree == NULL)
-	{
-		return freeCMD(tree);
-	}
+	useScratch(p, line);
+	p->ev = ev ? ev : &none;
+	p->evCtx = ctx;
 
-	while(((tree != NULL) && listIndex < listLen) && 
-		((list[listIndex]->type == SEP_END) || (list[listIndex]->type == SEP_BG)))
-	{
-		CMD* treeBig;
+	bool more = false;
 
-		if(list[listIndex]->type == SEP_END)
-		{
-			treeBig = mallocCMD(SEP_END, NULL, NULL);
-		}
-		else
+	p->listLen = lexLine(p, len, 0, false, &more);
+	int result = checkLine(p->error == ERROR, p->listLen, p->leftPar, p->rightPar);
+	if(result > 0)
+	{
+		statsPhase(PHASE_PARSE);
+		result = emitCMD(p) ? 1 : -1;
+		if(p->ev->endCommand)
 		{
-			treeBig = mallocCMD(SEP_BG, NULL, NULL);
+			p->ev->endCommand(p->evCtx, result > 0);
 		}
+	}
 
-		listIndex++;
-
-		if(listIndex >= listLen)
-		{
-			error = ERROR;
-			fprintf(stderr, "parsley: NULL command sequence\n");
+	p->arena = NULL; //the scratch arena is kept for the next line
+	p->ev = NULL;
+	statsPhase(phase);
+	if(start)
+	{
+		statsLine(start);
+	}
+	return result;
+}
 
-			freeCMD(tree);
-			return freeCMD(treeBig);
-		}	
+int lex (Parser *p, char *line, size_t len, Lexeme *toks, int max)
+{
+	uint64_t start = statsCur ? statsNow() : 0;
+	int phase = statsPhase(PHASE_LEX);
+	bool more = false;
 
-		CMD *tree2 = makeAndOr(list);
+	useScratch(p, line);
+	int n = lexLine(p, len, 0, false, &more);
 
-		if(error == ERROR || tree2 == NULL)
-		{
-			freeCMD(tree);
-			freeCMD(treeBig);
-			return freeCMD(tree2);
-		}
-		else
-		{
-			treeBig->left = tree;
-			treeBig->right = tree2;
+	for(int i = 0; i < n && i < max; i++)
+	{
+		toks[i].type = p->list[i].type;
+		toks[i].start = p->list[i].start;
+		toks[i].end = p->list[i].start + p->list[i].len;
+	}
 
-			tree = treeBig;
-		}
+	p->arena = NULL; //the scratch arena is kept for the next line
+	p->listLen = 0;
+	p->error = 0;
+	statsPhase(phase);
+	if(start)
+	{
+		statsLine(start);
 	}
-	return tree;
+	return n;
 }
-
-
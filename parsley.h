@@ -13,6 +13,9 @@
 #include <ctype.h>
 #include <malloc.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include "arena.h"
+#include "writer.h"
 
 // A token is
 //
@@ -78,6 +81,12 @@ enum {TEXT,             // Maximal contiguous sequence ... (as above)
                       type == RED_ERR || type == RED_ERR_APP || \
                       type == RED_OUT_ERR)
 
+
+// How tightly each operator binds in a command tree, indexed by token type:
+// | (3) before && and || (2), and those before ; and & (1).  All are
+// left-associative; 0 for anything else.
+extern const int opPrec[ERROR+1];
+
 /////////////////////////////////////////////////////////////////////////////
 
 // The syntax for a command is
@@ -203,6 +212,9 @@ typedef struct cmd {
                         //   RED_IN_HERE (<<)
   char *fromFile;       // File to redirect stdin, contents of here document,
                         //   or NULL (default)
+  int fromFd;           // Descriptor of a file holding a here document too
+                        //   long for fromFile, or -1 (default)
+  size_t fromLen;       // Length of that here document
 
   int toType;           // Redirect stdout: NONE (default), RED_OUT (>),
                         //   RED_OUT_APP (>>), or  RED_OUT_ERR (&>)
@@ -214,10 +226,17 @@ typedef struct cmd {
 
   struct cmd *left;     // Left subtree or NULL (default)
   struct cmd *right;    // Right subtree or NULL (default)
+
+  Arena *arena;         // Arena holding the whole tree (see parse()) or NULL
+                        //   (default) if the struct was malloc()-ed
 } CMD;
 
 // Note:  In a [stage] with a HERE document, fromFile should point to a string
-// containing the lines in that document.
+// containing the lines in that document, unless the document is longer than
+// the limit set by parserSetHereMax().  Then fromFile is NULL and fromFd is a
+// descriptor (positioned at the start) of an anonymous file holding the
+// fromLen chars of the document, which an executor can splice to the stdin
+// of the command.  The descriptor is closed by freeCMD().
 //
 // Note:  In a [stage] with &> (= RED_OUT_ERR) redirection, toType and errType
 // should be RED_OUT_ERR, toFile should point to the filename, and errFile
@@ -229,16 +248,221 @@ typedef struct cmd {
 CMD *mallocCMD (int type, CMD *left, CMD *right);
 
 
-// Print the command data structure CMD as a tree whose root is at level LEVEL
+// Print the command data structure CMD as a tree whose root is at level LEVEL.
+// The walk does not recurse, so the depth of the tree is bounded only by
+// memory (see walk.h).
 void dumpTree (CMD *exec, int level);
 
 
-// Free the command structure CMD and return NULL
+// Same as dumpTree(), but print to the stream OUT instead of stdout
+void fdumpTree (FILE *out, CMD *exec, int level);
+
+
+// Same as dumpTree(), but append the output to the writer W (see writer.h),
+// which avoids stdio entirely
+void wdumpTree (Writer *w, CMD *exec, int level);
+
+
+// Same as wdumpTree(), but append only the line for the node EXEC (not its
+// children), and without the "CMD (Depth = N):  " that starts it
+void wdumpNode (Writer *w, CMD *exec);
+
+
+// Free the command structure CMD and return NULL.  If CMD was allocated from
+// an arena, the whole tree in that arena is released at once; otherwise the
+// nodes are freed one at a time without recursion.
 CMD *freeCMD (CMD *cmd);
 
 
 // Parse a token list into a command structure and return a pointer to
-// that structure (NULL if errors found).
+// that structure (NULL if errors found, after writing a message to stderr).
+// The tokens, strings, and CMD structs all come from one arena owned by the
+// tree, so freeCMD() on the root is a single arena release.
 CMD *parse (char *line);
 
+
+// Parser context: all of the state of a parse in progress.  parse() uses one
+// shared context and so is not reentrant; threads that parse at the same time
+// must each call parse_r() with a context of their own.
+typedef struct parser Parser;
+
+
+// Allocate, initialize, and return a pointer to a parser context
+Parser *mallocParser (void);
+
+
+// Free the parser context P and return NULL
+Parser *freeParser (Parser *p);
+
+
+// Same as parse(), but using the parser context P
+CMD *parse_r (Parser *p, char *line);
+
+
+// Same as parse_r(), but LINE is the LEN chars at LINE, which need not be
+// NUL-terminated (e.g., a slice of a memory-mapped script)
+CMD *parse_n (Parser *p, char *line, size_t len);
+
+
+// Read the lines of HERE documents for parser context P from IN (stdin by
+// default)
+void parserSetInput (Parser *p, FILE *in);
+
+
+// Keep HERE documents parsed with context P in memory only if they have at
+// most MAX chars (SIZE_MAX, the default, means always); see fromFd above
+void parserSetHereMax (Parser *p, size_t max);
+
+
+// Counters of a parse cache (see parserSetCache())
+typedef struct cacheStats {
+    unsigned long hits;                 // Lines whose tree was in the cache
+    unsigned long misses;               // Lines parsed and (if valid) added
+    unsigned long bypasses;             // Lines that may have HERE documents
+    unsigned long evictions;            // Trees evicted to make room
+    size_t entries;                     // #trees in the cache
+    size_t bytes;                       // #bytes held by the cache
+} CacheStats;
+
+
+// Give parser context P a cache of at most MAXBYTES bytes (none if 0) of
+// recently parsed lines and their trees.  A line whose text (up to any
+// comment) is in the cache is not parsed again: parse_r() returns the same
+// tree, which the caller must not modify but still frees with freeCMD().
+// Lines with "<<" are never cached, since their trees include the lines that
+// follow.
+void parserSetCache (Parser *p, size_t maxBytes);
+
+
+// Set *S to the counters of the cache of parser context P (all 0 if none)
+void parserCacheStats (Parser *p, CacheStats *s);
+
+
+// Read the lines of HERE documents for parser context P from the LEN chars at
+// BUF (e.g., a private mapping of the script), starting at offset *POS and
+// advancing *POS past them, instead of from a stream.  Each document is left
+// in BUF: fromFile points into BUF, and the NUL that ends it overwrites the
+// first char of its terminating line, so BUF must be writable and must
+// outlive the trees.
+void parserSetBuffer (Parser *p, char *buf, size_t len, size_t *pos);
+
+
+// Let a command parsed with context P go on past the end of its line when
+// ON is true (false is the default): a line that ends with a backslash-newline
+// or leaves a ( open is incomplete.  Then parse_r() keeps the tokens found so
+// far in P and returns NULL, parserPending() returns true, and the next call
+// to parse_r() adds the tokens of the next line to them, so that each line is
+// read only once however long the command grows.  A backslash-newline inside
+// a word joins it to the start of the next line.  Set ON before parsing any
+// line with P.
+void parserSetContinue (Parser *p, bool on);
+
+
+// Return true if parser context P holds an incomplete command
+bool parserPending (Parser *p);
+
+
+// Parse the incomplete command held by parser context P (e.g., at end of
+// file) as if its last line were the end of it; return NULL if there is none
+CMD *parserFinish (Parser *p);
+
+
+// Callbacks made by parseEvents() as it recognizes the parts of a command, in
+// the order of their tokens; any may be NULL.  A [stage] is reported as
+//
+//   beginStage, its locals and redirections (in any order), and then either
+//     the args of a [simple] (among any more redirections) and endStage, or
+//     openSubcmd, the [command] in the ( ), closeSubcmd, the redirections of
+//     its [redList], and endStage,
+//
+// with op between stages (and after the last one if the [command] ends with
+// ; or &).  Strings are not NUL-terminated; they are spans of the line or of
+// storage in the parser context that stay valid until the next call to
+// parseEvents() with it.
+typedef struct parseEvents {
+    void (*beginStage) (void *ctx);
+    void (*local)      (void *ctx, const char *name, size_t nameLen,
+                                   const char *value, size_t valueLen);
+    void (*redirect)   (void *ctx, int type,    // RED_IN, RED_IN_HERE, ...
+                        const char *file,       // Filename, contents of HERE
+                        size_t len,             //   document, or NULL if the
+                        int fd);                //   document is in the file
+                                                //   FD (see fromFd); len is
+                                                //   always its length
+    void (*arg)        (void *ctx, const char *arg, size_t len);
+    void (*openSubcmd) (void *ctx);
+    void (*closeSubcmd)(void *ctx);
+    void (*endStage)   (void *ctx);
+    void (*op)         (void *ctx, int type);   // PIPE, SEP_AND, SEP_OR,
+                                                //   SEP_END, or SEP_BG
+    void (*endCommand) (void *ctx, bool ok);    // After the rest; OK is false
+                                                //   if an error stopped it
+} ParseEvents;
+
+
+// Recognize the command in the LEN chars at LINE with parser context P, as
+// parse_n() does, but instead of building a tree make the callbacks in EV
+// with the context CTX as its parts are found.  Return 1 if LINE holds a
+// command, 0 if it holds none (e.g., it is blank), or -1 on error (reported
+// as by parse()).  With EV NULL, just check the syntax: once the context has
+// parsed a line as long, only HERE documents allocate any storage.  Each line
+// is a whole command (see parserSetContinue()), and the cache is not used.
+int parseEvents (Parser *p, char *line, size_t len, const ParseEvents *ev,
+                 void *ctx);
+
+
+// A token found by lex()
+typedef struct lexeme {
+    int type;                           // TEXT, RED_IN, ..., or PAR_RIGHT
+    size_t start;                       // Offset of its first char
+    size_t end;                         // Offset just past its last char
+} Lexeme;
+
+
+// Split the LEN chars at LINE into tokens with parser context P, as parse_n()
+// does, but do not parse them; store the first MAX of them in TOKS, and
+// return how many there are (which may be more than MAX).  A comment ends
+// the tokens, and an operator that needs a filename is a token even at the
+// end of the line.  Nothing is reported on stderr, and once the context has
+// lexed a line as long, nothing is allocated (e.g., for a syntax highlighter
+// that lexes the line on each keystroke).  P must not hold an incomplete
+// command (see parserSetContinue()).
+int lex (Parser *p, char *line, size_t len, Lexeme *toks, int max);
+
+
+// A command line kept with its tokens and tree so that it can be re-parsed
+// cheaply after each edit (e.g., for live syntax feedback as it is typed)
+typedef struct parse Parse;
+
+
+// Parse the LEN chars at LINE with parser context P and keep the result for
+// reparse(); the tree (NULL if there are errors) is given by parseTree()
+Parse *mallocParse (Parser *p, const char *line, size_t len);
+
+
+// Replace the DELLEN chars at offset OFF of the line kept in PS by the INSLEN
+// chars at INS, re-parse it with parser context P, and return the new tree
+// (NULL if there are errors, which are reported as by parse()).  Only the
+// tokens around the edit are lexed again, and subtrees (stages and the links
+// of PIPE, &&/||, and ;/& chains) whose tokens the edit did not touch are
+// reused, so the cost depends mostly on the size of the edit rather than of
+// the line.  The previous tree is no longer valid.  P must not hold an
+// incomplete command (see parserSetContinue()).  HERE documents are not read:
+// their bodies are empty, since the lines after the command are not known.
+CMD *reparse (Parser *p, Parse *ps, size_t off, size_t delLen,
+              const char *ins, size_t insLen);
+
+
+// Return the tree for the line kept in PS (NULL if it has errors).  The tree
+// belongs to PS: do not call freeCMD() on it.
+CMD *parseTree (Parse *ps);
+
+
+// Return the (NUL-terminated) line kept in PS
+const char *parseText (Parse *ps);
+
+
+// Free PS (and its tree) and return NULL
+Parse *freeParse (Parse *ps);
+
 #endif
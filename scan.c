@@ -0,0 +1,174 @@
+// scan.c
+//
+// Character classes for the tokenizer, and scanners that find the end of a
+// TEXT token.  The SSE2 and AVX2 scanners test a whole vector of chars against
+// CC_DELIM at once and fall back to scanScalar() for the last partial vector.
+// The AVX2 code is compiled with a target attribute, so no special compiler
+// flags are needed; bestScanner() checks the CPU at run time.
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define S CC_SPACE
+#define M CC_META
+#define E CC_ESCAPE
+#define C CC_COMMENT
+#define V CC_VARCHR
+#define D (CC_VARCHR | CC_DIGIT)
+
+const unsigned char charClass[256] = {
+//  NUL                         \t \n \v \f \r
+    0, 0, 0, 0, 0, 0, 0, 0, 0, S, S, S, S, S, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+//  sp !  "  #  $  %  &  '  (  )  *  +  ,  -  .  /
+    S, 0, 0, C, 0, 0, M, 0, M, M, 0, 0, 0, 0, 0, 0,
+//  0  1  2  3  4  5  6  7  8  9  :  ;  <  =  >  ?
+    D, D, D, D, D, D, D, D, D, D, 0, M, M, 0, M, 0,
+//  @  A  B  C  D  E  F  G  H  I  J  K  L  M  N  O
+    0, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+//  P  Q  R  S  T  U  V  W  X  Y  Z  [  \  ]  ^  _
+    V, V, V, V, V, V, V, V, V, V, V, 0, E, 0, 0, V,
+//  `  a  b  c  d  e  f  g  h  i  j  k  l  m  n  o
+    0, V, V, V, V, V, V, V, V, V, V, V, V, V, V, V,
+//  p  q  r  s  t  u  v  w  x  y  z  {  |  }  ~  DEL
+    V, V, V, V, V, V, V, V, V, V, V, 0, M, 0, 0, 0,
+};
+
+#undef S
+#undef M
+#undef E
+#undef C
+#undef V
+#undef D
+
+
+int scanScalar (const char *line, int i, int length)
+{
+    while (i < length && !(CLASS(line[i]) & CC_DELIM))
+        i++;
+    return i;
+}
+
+
+#ifdef SCAN_X86
+
+// The chars in CC_DELIM are \t \n \v \f \r (9-13), space, backslash, and the
+// metachars & ( ) ; < > |.  Since ( and ) differ only in bit 0 and < and >
+// only in bit 1, setting that bit first lets one compare find both.
+
+#if defined(__i386__) && !defined(__SSE2__)
+__attribute__ ((target ("sse2")))
+#endif
+int scanSSE2 (const char *line, int i, int length)
+{
+    const __m128i tab   = _mm_set1_epi8 ('\t');
+    const __m128i four  = _mm_set1_epi8 (4);
+    const __m128i space = _mm_set1_epi8 (' ');
+    const __m128i bslash= _mm_set1_epi8 ('\\');
+    const __m128i amp   = _mm_set1_epi8 ('&');
+    const __m128i semi  = _mm_set1_epi8 (';');
+    const __m128i bar   = _mm_set1_epi8 ('|');
+    const __m128i one   = _mm_set1_epi8 (1);
+    const __m128i two   = _mm_set1_epi8 (2);
+    const __m128i paren = _mm_set1_epi8 (')');
+    const __m128i angle = _mm_set1_epi8 ('>');
+
+    for ( ; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128 ((const __m128i *) (line + i));
+        __m128i w = _mm_sub_epi8 (v, tab);                  // 9-13 => 0-4
+        __m128i d = _mm_cmpeq_epi8 (_mm_min_epu8 (w, four), w);
+        d = _mm_or_si128 (d, _mm_cmpeq_epi8 (v, space));
+        d = _mm_or_si128 (d, _mm_cmpeq_epi8 (v, bslash));
+        d = _mm_or_si128 (d, _mm_cmpeq_epi8 (v, amp));
+        d = _mm_or_si128 (d, _mm_cmpeq_epi8 (v, semi));
+        d = _mm_or_si128 (d, _mm_cmpeq_epi8 (v, bar));
+        d = _mm_or_si128 (d, _mm_cmpeq_epi8 (_mm_or_si128 (v, one), paren));
+        d = _mm_or_si128 (d, _mm_cmpeq_epi8 (_mm_or_si128 (v, two), angle));
+
+        int mask = _mm_movemask_epi8 (d);
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+    return scanScalar (line, i, length);
+}
+
+
+__attribute__ ((target ("avx2")))
+int scanAVX2 (const char *line, int i, int length)
+{
+    const __m256i tab   = _mm256_set1_epi8 ('\t');
+    const __m256i four  = _mm256_set1_epi8 (4);
+    const __m256i space = _mm256_set1_epi8 (' ');
+    const __m256i bslash= _mm256_set1_epi8 ('\\');
+    const __m256i amp   = _mm256_set1_epi8 ('&');
+    const __m256i semi  = _mm256_set1_epi8 (';');
+    const __m256i bar   = _mm256_set1_epi8 ('|');
+    const __m256i one   = _mm256_set1_epi8 (1);
+    const __m256i two   = _mm256_set1_epi8 (2);
+    const __m256i paren = _mm256_set1_epi8 (')');
+    const __m256i angle = _mm256_set1_epi8 ('>');
+
+    for ( ; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256 ((const __m256i *) (line + i));
+        __m256i w = _mm256_sub_epi8 (v, tab);               // 9-13 => 0-4
+        __m256i d = _mm256_cmpeq_epi8 (_mm256_min_epu8 (w, four), w);
+        d = _mm256_or_si256 (d, _mm256_cmpeq_epi8 (v, space));
+        d = _mm256_or_si256 (d, _mm256_cmpeq_epi8 (v, bslash));
+        d = _mm256_or_si256 (d, _mm256_cmpeq_epi8 (v, amp));
+        d = _mm256_or_si256 (d, _mm256_cmpeq_epi8 (v, semi));
+        d = _mm256_or_si256 (d, _mm256_cmpeq_epi8 (v, bar));
+        d = _mm256_or_si256 (d,
+                _mm256_cmpeq_epi8 (_mm256_or_si256 (v, one), paren));
+        d = _mm256_or_si256 (d,
+                _mm256_cmpeq_epi8 (_mm256_or_si256 (v, two), angle));
+
+        unsigned mask = _mm256_movemask_epi8 (d);
+        if (mask)
+            return i + __builtin_ctz (mask);
+    }
+    return scanSSE2 (line, i, length);
+}
+
+
+Scanner bestScanner (void)
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports ("avx2"))
+        return scanAVX2;
+    if (__builtin_cpu_supports ("sse2"))
+        return scanSSE2;
+    return scanScalar;
+}
+
+#else   // No vector scanners on other CPUs
+
+int scanSSE2 (const char *line, int i, int length)
+{
+    return scanScalar (line, i, length);
+}
+
+
+int scanAVX2 (const char *line, int i, int length)
+{
+    return scanScalar (line, i, length);
+}
+
+
+Scanner bestScanner (void)
+{
+    return scanScalar;
+}
+
+#endif
+
+
+const char *scannerName (Scanner scan)
+{
+    return (scan == scanAVX2) ? "avx2"
+         : (scan == scanSSE2) ? "sse2"
+         :                      "scalar";
+}
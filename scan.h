@@ -0,0 +1,43 @@
+// scan.h
+//
+// Header file for the character classes used by the tokenizer in parse() and
+// for the scanners that find where a TEXT token ends.  The scanners look at
+// 16 (SSE2) or 32 (AVX2) chars at a time when the CPU supports it.
+
+#ifndef SCAN_INCLUDED
+#define SCAN_INCLUDED           // scan.h has been #include-d
+
+// Character classes; a char may be in more than one
+#define CC_SPACE   0x01         // isspace(): separates tokens
+#define CC_META    0x02         // In METACHAR: ends a TEXT token, starts an
+                                //   operator
+#define CC_ESCAPE  0x04         // Backslash: escapes the next char
+#define CC_COMMENT 0x08         // #: starts a comment at the start of a token
+#define CC_VARCHR  0x10         // In VARCHR: may appear in a variable name
+#define CC_DIGIT   0x20         // Digit: may not start a variable name
+
+#define CC_DELIM (CC_SPACE | CC_META | CC_ESCAPE)  // Chars that stop a scan
+
+// Class of each char (in the C locale); chars 128-255 are in no class
+extern const unsigned char charClass[256];
+
+#define CLASS(c) charClass[(unsigned char) (c)]
+
+
+// A scanner returns the index of the first char in LINE[I] ... LINE[LENGTH-1]
+// that is in CC_DELIM, or LENGTH if there is none
+typedef int (*Scanner) (const char *line, int i, int length);
+
+int scanScalar (const char *line, int i, int length);   // One char at a time
+int scanSSE2 (const char *line, int i, int length);     // 16 chars at a time
+int scanAVX2 (const char *line, int i, int length);     // 32 chars at a time
+
+
+// Return the fastest scanner that this CPU supports
+Scanner bestScanner (void);
+
+
+// Return the name of scanner SCAN ("scalar", "sse2", or "avx2")
+const char *scannerName (Scanner scan);
+
+#endif
@@ -0,0 +1,229 @@
+// stats.c
+//
+// Counters for parsley --stats; see stats.h.  The latency histogram is
+// log-linear: values below 16 ns have a bucket each, and each power of 2
+// above that is split into 16 buckets, so a percentile read from it is within
+// 1/16 (about 6%) of the true value.
+
+#include "stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define SUB_BUCKETS 16                  // Buckets per power of 2 (2^SUB_BITS)
+#define SUB_BITS    4
+#define N_BUCKETS   (64 * SUB_BUCKETS)
+
+// Time and allocations in one phase
+typedef struct {
+    uint64_t ns;                        // Time spent
+    unsigned long allocs;               // #malloc()/realloc() calls
+    size_t bytes;                       //   and #bytes they asked for
+    unsigned long arenaObjs;            // #objects allocated from arenas
+    size_t arenaBytes;                  //   and their #bytes
+} Phase;
+
+struct stats {
+    Phase phase[N_PHASES];
+    int cur;                            // Current phase
+    uint64_t since;                     // When it was entered
+    unsigned long lines;                // #lines in the histogram
+    uint64_t total;                     // Sum of their times
+    uint64_t max;                       // Longest of them
+    unsigned long bucket[N_BUCKETS];    // Histogram of their times
+};
+
+static const char *phaseName[N_PHASES] = {
+    [PHASE_OTHER] = "other", [PHASE_LEX] = "lex", [PHASE_PARSE] = "parse",
+    [PHASE_HERE] = "here", [PHASE_DUMP] = "dump", [PHASE_FREE] = "free",
+};
+
+__thread Stats *statsCur = NULL;
+
+
+Stats *mallocStats (void)
+{
+    return calloc (1, sizeof(Stats));
+}
+
+
+Stats *freeStats (Stats *s)
+{
+    free (s);
+    return NULL;
+}
+
+
+uint64_t statsNow (void)
+{
+    struct timespec t;
+    clock_gettime (CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+
+void statsStart (Stats *s)
+{
+    statsCur = s;
+    s->cur = PHASE_OTHER;
+    s->since = statsNow();
+}
+
+
+void statsStop (void)
+{
+    statsPhase (PHASE_OTHER);
+    statsCur = NULL;
+}
+
+
+int statsPhase (int phase)
+{
+    Stats *s = statsCur;
+    if (!s)
+        return phase;
+
+    uint64_t t = statsNow();
+    int prev = s->cur;
+    s->phase[prev].ns += t - s->since;
+    s->since = t;
+    s->cur = phase;
+    return prev;
+}
+
+
+void statsAlloc (size_t n)
+{
+    Phase *ph = &statsCur->phase[statsCur->cur];
+    ph->allocs++;
+    ph->bytes += n;
+}
+
+
+void statsArena (size_t n)
+{
+    Phase *ph = &statsCur->phase[statsCur->cur];
+    ph->arenaObjs++;
+    ph->arenaBytes += n;
+}
+
+
+// Return the bucket of the histogram for a time of NS nanoseconds
+static int bucketOf (uint64_t ns)
+{
+    if (ns < SUB_BUCKETS)
+        return ns;
+
+    int e = 63 - __builtin_clzll (ns);          // 2^e <= ns < 2^(e+1)
+    int sub = (ns >> (e - SUB_BITS)) & (SUB_BUCKETS - 1);
+    return (e - SUB_BITS + 1) * SUB_BUCKETS + sub;
+}
+
+
+// Return the midpoint of the times in bucket B of the histogram
+static double bucketValue (int b)
+{
+    if (b < SUB_BUCKETS)
+        return b;
+
+    int e = b / SUB_BUCKETS + SUB_BITS - 1;
+    uint64_t width = (uint64_t) 1 << (e - SUB_BITS);
+    uint64_t low = (uint64_t) (SUB_BUCKETS + b % SUB_BUCKETS) * width;
+    return low + width / 2.0;
+}
+
+
+void statsLine (uint64_t start)
+{
+    Stats *s = statsCur;
+    if (!s)
+        return;
+
+    uint64_t ns = statsNow() - start;
+    s->lines++;
+    s->total += ns;
+    if (ns > s->max)
+        s->max = ns;
+    s->bucket[bucketOf (ns)]++;
+}
+
+
+void statsMerge (Stats *to, const Stats *from)
+{
+    for (int i = 0; i < N_PHASES; i++) {
+        to->phase[i].ns         += from->phase[i].ns;
+        to->phase[i].allocs     += from->phase[i].allocs;
+        to->phase[i].bytes      += from->phase[i].bytes;
+        to->phase[i].arenaObjs  += from->phase[i].arenaObjs;
+        to->phase[i].arenaBytes += from->phase[i].arenaBytes;
+    }
+    to->lines += from->lines;
+    to->total += from->total;
+    if (from->max > to->max)
+        to->max = from->max;
+    for (int b = 0; b < N_BUCKETS; b++)
+        to->bucket[b] += from->bucket[b];
+}
+
+
+// Return the time in nanoseconds below which a fraction Q of the lines in S
+// were parsed
+static double percentile (const Stats *s, double q)
+{
+    unsigned long rank = q * s->lines;
+    unsigned long seen = 0;
+
+    for (int b = 0; b < N_BUCKETS; b++) {
+        seen += s->bucket[b];
+        if (seen > rank)
+            return bucketValue (b);
+    }
+    return s->max;
+}
+
+
+// Write the time NS to OUT in units that suit it
+static void printTime (FILE *out, double ns)
+{
+    if (ns < 1e3)
+        fprintf (out, "%.0f ns", ns);
+    else if (ns < 1e6)
+        fprintf (out, "%.1f us", ns / 1e3);
+    else if (ns < 1e9)
+        fprintf (out, "%.1f ms", ns / 1e6);
+    else
+        fprintf (out, "%.2f s", ns / 1e9);
+}
+
+
+void statsReport (const Stats *s, double wall, FILE *out)
+{
+    uint64_t total = 0;
+    for (int i = 0; i < N_PHASES; i++)
+        total += s->phase[i].ns;
+
+    fprintf (out, "parsley: stats: %lu lines in %.3f s\n", s->lines, wall);
+    fprintf (out, "  %-6s %11s %6s %10s %12s %11s %12s\n", "phase", "time (ms)",
+             "%", "allocs", "bytes", "arena objs", "arena bytes");
+    for (int i = 1; i <= N_PHASES; i++) {
+        const Phase *ph = &s->phase[i % N_PHASES];      // Other goes last
+        fprintf (out, "  %-6s %11.3f %5.1f%% %10lu %12zu %11lu %12zu\n",
+                 phaseName[i % N_PHASES], ph->ns / 1e6,
+                 total ? 100.0 * ph->ns / total : 0.0,
+                 ph->allocs, ph->bytes, ph->arenaObjs, ph->arenaBytes);
+    }
+
+    if (s->lines == 0)
+        return;
+    fprintf (out, "  parse time per line: mean ");
+    printTime (out, (double) s->total / s->lines);
+    fprintf (out, ", p50 ");
+    printTime (out, percentile (s, 0.50));
+    fprintf (out, ", p99 ");
+    printTime (out, percentile (s, 0.99));
+    fprintf (out, ", p999 ");
+    printTime (out, percentile (s, 0.999));
+    fprintf (out, ", max ");
+    printTime (out, s->max);
+    fprintf (out, "\n");
+}
@@ -0,0 +1,79 @@
+// stats.h
+//
+// Header file for the counters behind parsley --stats: the time spent in each
+// phase of handling a line, the allocations made in each phase, and a
+// histogram of the time that parse_r() takes on each line.
+//
+// Counting is per thread: statsStart() makes a thread count into a Stats of
+// its own, and statsMerge() adds them up at the end.  On a thread that has
+// not called statsStart(), every hook below costs just a test of a
+// thread-local pointer.
+
+#ifndef STATS_INCLUDED
+#define STATS_INCLUDED          // stats.h has been #include-d
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Phases, each timed and charged with the allocations made during it
+#define PHASE_OTHER  0          // Anything else: reading lines, prompts, ...
+#define PHASE_LEX    1          // Tokenizing a line (and parse cache lookups)
+#define PHASE_PARSE  2          // Building the tree: makeCMD()
+#define PHASE_HERE   3          // Reading HERE documents (within PHASE_PARSE)
+#define PHASE_DUMP   4          // dumpTree() or the JSON form of the tree
+#define PHASE_FREE   5          // freeCMD()
+#define N_PHASES     6
+
+typedef struct stats Stats;
+
+extern __thread Stats *statsCur;        // Counters of this thread or NULL
+
+
+// Allocate and return a pointer to a set of counters, all zero
+Stats *mallocStats (void);
+
+
+// Free the counters S and return NULL
+Stats *freeStats (Stats *s);
+
+
+// Make this thread count into S from now on, starting in PHASE_OTHER
+void statsStart (Stats *s);
+
+
+// Stop counting on this thread (closing the current phase)
+void statsStop (void);
+
+
+// Switch this thread to PHASE and return the phase it was in, so that the
+// caller can switch back; nested phases are timed separately
+int statsPhase (int phase);
+
+
+// Count an allocation of N bytes from malloc() or realloc() (STATS_ALLOC) or
+// of an N-byte object from an arena (STATS_ARENA) in the current phase
+void statsAlloc (size_t n);
+void statsArena (size_t n);
+
+#define STATS_ALLOC(n)  do { if (statsCur) statsAlloc (n); } while (0)
+#define STATS_ARENA(n)  do { if (statsCur) statsArena (n); } while (0)
+
+
+// Return a timestamp in nanoseconds for statsLine()
+uint64_t statsNow (void);
+
+
+// Add a line that took from START (see statsNow()) until now to parse to the
+// histogram
+void statsLine (uint64_t start);
+
+
+// Add the counters FROM to TO
+void statsMerge (Stats *to, const Stats *from);
+
+
+// Write a report on S, which covers WALL seconds, to OUT
+void statsReport (const Stats *s, double wall, FILE *out);
+
+#endif
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# batchCheck.sh
+#
+# Check that batch mode writes to stdout exactly what parsley writes when
+# reading the same input as stdin: for each FILE, and for a few lines of its
+# own (including ones that fail to parse, between valid ones, and HERE
+# documents), compare the output of parsley < FILE with that of
+# parsley -j N < FILE for N = 1, 2, and 4.  A FILE longer than a chunk (1024
+# lines) checks that the chunks are written in order.
+#
+# Usage: batchCheck.sh PARSLEY [FILE...]
+#
+# Exit status is 1 if any output differs.
+
+parsley=${1:?usage: batchCheck.sh PARSLEY [FILE...]}
+shift
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+printf 'a\nb\nc &> x\nd\n' > "$tmp/redirect"
+printf 'a | b\n( c\nd ; e &\nf >\ng < h > i\n' > "$tmp/errors"
+printf 'cat <<EOF\nx\nEOF\na | b <<E ; c\ny\nE\nd\n' > "$tmp/here"
+
+status=0
+for f in "$tmp/redirect" "$tmp/errors" "$tmp/here" "$@"; do
+    "$parsley" < "$f" > "$tmp/want" 2>/dev/null
+    for n in 1 2 4; do
+        "$parsley" -j $n < "$f" > "$tmp/got" 2>/dev/null
+        if ! cmp -s "$tmp/want" "$tmp/got"; then
+            echo "batchCheck: $(basename "$f"): -j $n differs from stdin mode"
+            status=1
+        fi
+    done
+done
+exit $status
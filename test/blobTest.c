@@ -0,0 +1,143 @@
+// blobTest.c
+//
+// Round-trip check of the binary form of command trees (see blob.h): parse
+// each command line of each script, convert its tree with cmdToBlob(), check
+// the blob with blobCheck(), and compare a dump of the blob (made with the
+// blob readers alone) with the wdumpTree() of the tree.  Each script is run
+// twice, once with HERE documents in memory and once with every HERE document
+// spilled to a file (see parserSetHereMax()), which the blob must copy in.
+// A few scripts of its own come first: HERE documents in simple and [subcmd]
+// stages, locals and redirections, and a pipeline and a sequence so long that
+// a recursive walk of their trees would overflow the C stack.
+//
+// Usage: blobTest [FILE...]
+//
+// Writes each mismatch to stdout, then a summary; the exit status is 1 if
+// there was any mismatch.  Lines with parse errors are skipped (the parser's
+// messages on stderr are discarded).
+
+#include "testUtil.h"
+#include "../blob.h"
+
+// Append to W what wdumpTree() writes for the tree in BLOB, using only the
+// blob readers: each node becomes a CMD struct with the same fields (its HERE
+// document, if any, in fromFile) for wdumpNode().  The walk is in-order with
+// an explicit stack of (offset, depth) pairs.
+static void dumpBlob (Writer *w, const void *blob)
+{
+    size_t size = 64, top = 0;
+    struct { uint32_t off; int depth; } *stack = malloc (size * sizeof(*stack));
+    uint32_t off = ((const BlobHeader *) blob)->root;
+    int depth = 0;
+
+    for ( ; ; ) {
+        for ( ; off; off = blobNode (blob, off)->left) {
+            if (top == size)
+                stack = realloc (stack, (size *= 2) * sizeof(*stack));
+            stack[top].off = off;
+            stack[top++].depth = depth++;
+        }
+        if (top == 0)
+            break;
+
+        const BlobCmd *b = blobNode (blob, stack[--top].off);
+        depth = stack[top].depth;
+
+        char **vec = malloc ((b->argc + 2 * b->nLocal + 3) * sizeof(*vec));
+        char **argv = vec, **locVar = argv + b->argc + 1,
+             **locVal = locVar + b->nLocal + 1;
+        for (int i = 0; i < b->argc; i++)
+            argv[i] = (char *) blobArgv (blob, b, i);
+        argv[b->argc] = NULL;
+        for (int i = 0; i < b->nLocal; i++) {
+            locVar[i] = (char *) blobLocVar (blob, b, i);
+            locVal[i] = (char *) blobLocVal (blob, b, i);
+        }
+        locVar[b->nLocal] = locVal[b->nLocal] = NULL;
+
+        CMD c = {
+            .type = b->type, .argc = b->argc, .argv = argv,
+            .nLocal = b->nLocal,
+            .locVar = b->nLocal ? locVar : NULL,
+            .locVal = b->nLocal ? locVal : NULL,
+            .fromType = b->fromType,
+            .fromFile = (char *) blobString (blob, b->fromFile),
+            .fromFd = -1, .fromLen = b->fromLen,
+            .toType = b->toType, .toFile = (char *) blobString (blob, b->toFile),
+            .errType = b->errType,
+            .errFile = (char *) blobString (blob, b->errFile),
+            .left = (CMD *) blobNode (blob, b->left),     // Only tested
+            .right = (CMD *) blobNode (blob, b->right),   //   for NULL
+        };
+        wrLit (w, "CMD (Depth = ");
+        wrLong (w, depth);
+        wrLit (w, "):  ");
+        wdumpNode (w, &c);
+        free (vec);
+
+        off = b->right;
+        depth++;
+    }
+    free (stack);
+}
+
+
+// Check that the tree CMD round-trips through a blob, and free it; NAME and
+// LINE say where it came from
+static void check (CMD *cmd, const char *name, int line)
+{
+    Writer *want = mallocWriter (-1), *got = mallocWriter (-1);
+    size_t len;
+    void *blob = cmdToBlob (cmd, &len);
+
+    wdumpTree (want, cmd, 0);
+    if (!blob || !blobCheck (blob, len)) {
+        printf ("blobTest: %s:%d: %s\n", name, line,
+                blob ? "blobCheck() failed" : "cmdToBlob() failed");
+        nFails++;
+    } else {
+        dumpBlob (got, blob);
+        if (got->len != want->len || memcmp (got->buf, want->buf, got->len)) {
+            printf ("blobTest: %s:%d: dump of blob differs\n", name, line);
+            nFails++;
+        }
+    }
+    free (blob);
+    freeWriter (want);
+    freeWriter (got);
+    freeCMD (cmd);
+}
+
+
+// Run the script S (a string) both ways
+static void runBoth (const char *s, const char *name)
+{
+    runString (s, SIZE_MAX, name, check);
+    runString (s, 0, name, check);
+}
+
+
+int main (int argc, char *argv[])
+{
+    static const char cases[] =
+        "cat <<EOF\nline 1\n  line 2\nEOF\n"
+        "a=b <x c d >>y | (e <<E ; f &) >z && g\nhere\nE\n"
+        "x=1 y=2 < in cmd arg > out\n"
+        "( ( a ) ) ; b || c <<E &\n\nE\n"
+        "cat <<E\nE\n";
+
+    freopen ("/dev/null", "w", stderr);
+    runBoth (cases, "cases");
+
+    char *s = chain ("a b", " | ", LONG_CHAIN);
+    runBoth (s, "pipeline");
+    free (s);
+    s = chain ("x=1 a <b", " ; ", LONG_CHAIN);
+    runBoth (s, "sequence");
+    free (s);
+
+    if (!runFiles (argc - 1, argv + 1, SIZE_MAX, check)
+          || !runFiles (argc - 1, argv + 1, 0, check))
+        return EXIT_FAILURE;
+    return report ("blobTest");
+}
@@ -0,0 +1,78 @@
+// flatTest.c
+//
+// Round-trip check of the flat form of command trees (see flat.h): parse
+// each command line of each script, convert its tree T with cmdToFlat() and
+// back with flatToCmd(), and compare the wdumpTree() of the result with that
+// of T.  T is freed before the flat form is converted back, and the flat
+// form before the result is dumped, so each must keep alive what it needs of
+// the other.  The long pipeline and sequence of its own must also become one
+// node with a child for each stage or command.
+//
+// Usage: flatTest [FILE...]
+//
+// Writes each mismatch to stdout, then a summary; the exit status is 1 if
+// there was any mismatch.  Lines with parse errors are skipped (the parser's
+// messages on stderr are discarded).
+
+#include "testUtil.h"
+#include "../flat.h"
+
+static int nChildren;                   // If > 0, #children the root of the
+                                        //   flat form must have
+
+
+// Check that the tree CMD round-trips through the flat form, and free it;
+// NAME and LINE say where it came from
+static void check (CMD *cmd, const char *name, int line)
+{
+    char *want = dumpOf (cmd);
+    Flat *f = cmdToFlat (cmd);
+
+    freeCMD (cmd);
+    if (nChildren > 0 && f->n != nChildren) {
+        printf ("flatTest: %s:%d: root has %d children, not %d\n",
+                name, line, f->n, nChildren);
+        nFails++;
+    }
+
+    CMD *back = flatToCmd (f);
+    freeFlat (f);
+    char *got = dumpOf (back);
+    freeCMD (back);
+
+    if (strcmp (got, want) != 0) {
+        printf ("flatTest: %s:%d: dump after round trip differs\n",
+                name, line);
+        nFails++;
+    }
+    free (got);
+    free (want);
+}
+
+
+int main (int argc, char *argv[])
+{
+    static const char cases[] =
+        "a\n"
+        "a | b | c && d || e ; f & g\n"
+        "x=1 a <b ; c &\n"
+        "( a | b ; c ) >o | ( ( d && e ) ) ; f ;\n"
+        "a=b <x c <<E | (e && f &) >z &\nhere\nE\n"
+        "( a ; ( b & ) ) &\n";
+
+    freopen ("/dev/null", "w", stderr);
+    runString (cases, SIZE_MAX, "cases", check);
+
+    nChildren = LONG_CHAIN;
+    char *s = chain ("a b", " | ", LONG_CHAIN);
+    runString (s, SIZE_MAX, "pipeline", check);
+    free (s);
+    s = chain ("x=1 a <b", " ; ", LONG_CHAIN);
+    runString (s, SIZE_MAX, "sequence", check);
+    free (s);
+    nChildren = 0;
+
+    if (!runFiles (argc - 1, argv + 1, SIZE_MAX, check))
+        return EXIT_FAILURE;
+    return report ("flatTest");
+}
@@ -0,0 +1,162 @@
+// reparseTest.c
+//
+// Randomized check of the incremental re-parse API (see reparse() in
+// parsley.h): starting from a valid command line, apply random edits
+// (deleting up to 8 chars and inserting up to 2 words and operators) and
+// after each one compare the wdumpTree() of the tree from reparse() with that
+// of a full parse of the edited line, or both with NULL.  The full parse
+// reads HERE documents from an empty buffer, so that their bodies are empty,
+// as those of reparse() are.  Half the edits are made at random places in the
+// line; the other half are made in or next to a <<, a #, or an =, so that
+// edits inside HERE words, comments, and NAME=VALUE words are common.  Most
+// words inserted are plain, so that many of the lines stay valid, and now and
+// then the line is dropped and another started with mallocParse().
+//
+// Usage: reparseTest [-s SEED] [-n EDITS]
+//
+// SEED (default 1) seeds the random numbers, so the same arguments always
+// make the same edits; EDITS (default 200000) is the number of edits.
+// Writes the first few mismatches to stdout, then a summary; the exit status
+// is 1 if there was any mismatch.
+
+#include "testUtil.h"
+#include <unistd.h>
+
+#define MAX_LINE  400                   // Longest line built by the edits
+#define MAX_SHOWN 3                     // #mismatches written in full
+#define RESTART   40                    // 1 in RESTART edits starts anew
+
+// Lines that the edits start from
+static const char *starts[] = {
+    "a b | c && d ; e &",
+    "x=1 y=2 cmd <in arg >out",
+    "cat <<E | ( a=b f <<F ; g ) >>h",
+    "( a ; b ) | c || d # a comment",
+    "p=q \\( r s\\ t <<EOF && u",
+    "",
+};
+
+// Words and operators that the edits insert (each maybe after a blank);
+// the plain words come several times so that they are the most common
+static const char *atoms[] = {
+    "a", "bb", "f", "a", "bb", "f", "x=1", "y=", "x=1", "=", "c\\ d", "\\",
+    "\\#", "2", " ", "  ", "(", ")", "|", "||", "&&", ";", "&", "<", ">",
+    ">>", "&>", "<<E", "<<", "#c",
+};
+
+// Strings near which half the edits are made
+static const char *hot[] = {"<<", "#", "="};
+
+#define NELEM(a) (sizeof(a) / sizeof(*(a)))
+
+
+// Return the offset of a random edit in the LEN chars of TEXT: anywhere, or
+// in or next to a random occurrence of a string in hot[] if there is one
+static size_t pickOffset (const char *text, size_t len)
+{
+    if (len > 0 && rand() % 2) {
+        const char *h = hot[rand() % NELEM(hot)];
+        size_t n = 0;                           // #occurrences of H
+        for (const char *t = text; (t = strstr (t, h)); t++)
+            n++;
+        if (n > 0) {
+            const char *t = strstr (text, h);
+            for (size_t i = rand() % n; i > 0; i--)
+                t = strstr (t+1, h);
+            long off = (t - text) + rand() % 5 - 1;
+            return off < 0 ? 0 : (size_t) off > len ? len : (size_t) off;
+        }
+    }
+    return rand() % (len + 1);
+}
+
+
+int main (int argc, char *argv[])
+{
+    unsigned seed = 1;
+    long nEdits = 200000;
+    int opt;
+
+    while ((opt = getopt (argc, argv, "s:n:")) != -1) {
+        if (opt == 's')
+            seed = strtoul (optarg, NULL, 10);
+        else if (opt == 'n')
+            nEdits = atol (optarg);
+        else {
+            fprintf (stderr, "usage: reparseTest [-s SEED] [-n EDITS]\n");
+            return EXIT_FAILURE;
+        }
+    }
+    srand (seed);
+    freopen ("/dev/null", "w", stderr);         // Errors are expected
+
+    Parser *p = mallocParser();                 // For reparse()
+    Parser *q = mallocParser();                 // For the full parses
+    char empty[1] = "";
+    size_t pos = 0;
+    parserSetBuffer (q, empty, 0, &pos);        // HERE documents are empty
+
+    char text[MAX_LINE + 64];                   // The line, as edited
+    strcpy (text, starts[0]);
+    size_t len = strlen (text);
+    Parse *ps = mallocParse (p, text, len);
+    long nFails = 0;
+
+    for (long i = 0; i < nEdits; i++) {
+        size_t off = pickOffset (text, len);
+        size_t del = (rand() % 3 == 0 && off < len) ? rand() % 9 : 0;
+        if (del > len - off)
+            del = len - off;
+
+        char ins[64];
+        size_t insLen = 0;
+        for (int n = rand() % 3; n > 0; n--) {
+            const char *a = atoms[rand() % NELEM(atoms)];
+            if (rand() % 2)
+                ins[insLen++] = ' ';
+            memcpy (ins + insLen, a, strlen (a));
+            insLen += strlen (a);
+        }
+        if (len - del + insLen > MAX_LINE)      // Too long: cut the tail
+            del = len - off;
+
+        memmove (text + off + insLen, text + off + del, len - off - del + 1);
+        memcpy (text + off, ins, insLen);
+        len = len - del + insLen;
+
+        CMD *t = reparse (p, ps, off, del, ins, insLen);
+        if (strcmp (parseText (ps), text) != 0) {
+            printf ("reparseTest: seed %u, edit %ld: parseText() is wrong\n",
+                    seed, i);
+            return EXIT_FAILURE;
+        }
+
+        char line[MAX_LINE + 64];               // parse_n() may write to it
+        memcpy (line, text, len + 1);
+        pos = 0;
+        CMD *u = parse_n (q, line, len);
+
+        char *got = dumpOf (t), *want = dumpOf (u);
+        if (strcmp (got, want) != 0 && nFails++ < MAX_SHOWN)
+            printf ("reparseTest: seed %u, edit %ld: [%s]\n"
+                    "--- reparse() ---\n%s--- full parse ---\n%s",
+                    seed, i, text, got, want);
+        free (got);
+        free (want);
+        freeCMD (u);
+
+        if (rand() % RESTART == 0) {            // Start anew
+            strcpy (text, starts[rand() % NELEM(starts)]);
+            len = strlen (text);
+            freeParse (ps);
+            ps = mallocParse (p, text, len);
+        }
+    }
+
+    freeParse (ps);
+    freeParser (p);
+    freeParser (q);
+    printf ("reparseTest: seed %u, %ld edits, %ld mismatches\n",
+            seed, nEdits, nFails);
+    return nFails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,95 @@
+// testUtil.c
+//
+// What the checks in test/ share; see testUtil.h.
+
+#include "testUtil.h"
+
+long nTrees;
+long nFails;
+
+
+char *dumpOf (CMD *c)
+{
+    Writer *w = mallocWriter (-1);
+
+    if (c)
+        wdumpTree (w, c, 0);
+    else
+        wrLit (w, "NULL\n");
+    wrChar (w, '\0');
+
+    char *s = w->buf;                           // Keep the buffer but not
+    w->buf = NULL;                              //   the writer
+    freeWriter (w);
+    return s;
+}
+
+
+char *chain (const char *s, const char *op, int n)
+{
+    size_t ls = strlen (s), lo = strlen (op);
+    char *buf = malloc (n * (ls + lo) + 2), *t = buf;
+
+    for (int i = 0; i < n; i++) {
+        if (i > 0) {
+            memcpy (t, op, lo);
+            t += lo;
+        }
+        memcpy (t, s, ls);
+        t += ls;
+    }
+    strcpy (t, "\n");
+    return buf;
+}
+
+
+void runScript (FILE *in, size_t hereMax, const char *name, TreeCheck *check)
+{
+    Parser *p = mallocParser();
+    char *line = NULL;
+    size_t nLine = 0;
+
+    parserSetHereMax (p, hereMax);
+    parserSetInput (p, in);
+    for (int lineNo = 1; getline (&line, &nLine, in) > 0; lineNo++) {
+        CMD *cmd = parse_r (p, line);
+        if (cmd) {
+            nTrees++;
+            check (cmd, name, lineNo);
+        }
+    }
+    free (line);
+    freeParser (p);
+}
+
+
+void runString (const char *s, size_t hereMax, const char *name,
+                TreeCheck *check)
+{
+    FILE *in = fmemopen ((char *) s, strlen (s), "r");
+
+    runScript (in, hereMax, name, check);
+    fclose (in);
+}
+
+
+bool runFiles (int n, char *file[], size_t hereMax, TreeCheck *check)
+{
+    for (int i = 0; i < n; i++) {
+        FILE *in = fopen (file[i], "r");
+        if (!in) {
+            perror (file[i]);
+            return false;
+        }
+        runScript (in, hereMax, file[i], check);
+        fclose (in);
+    }
+    return true;
+}
+
+
+int report (const char *prog)
+{
+    printf ("%s: %ld trees, %ld mismatches\n", prog, nTrees, nFails);
+    return nFails ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+// testUtil.h
+//
+// Header file for what the checks in test/ share: dumps of trees as strings,
+// long one-line scripts, and a runner that parses each command line of a
+// script and passes each tree to a check of the caller's.
+
+#ifndef TESTUTIL_INCLUDED
+#define TESTUTIL_INCLUDED       // testUtil.h has been #include-d
+
+#include "../parsley.h"
+
+#define LONG_CHAIN 200000               // #stages in the long pipeline and
+                                        //   #commands in the long sequence
+
+extern long nTrees;                     // #trees checked (by runScript())
+extern long nFails;                     // #trees that failed their check
+
+// A check of the tree CMD parsed from line LINE of the script NAME, which
+// counts each failure in nFails and frees CMD
+typedef void TreeCheck (CMD *cmd, const char *name, int line);
+
+
+// Return a copy (malloc()-ed, NUL-terminated) of what wdumpTree() writes for
+// C, or of "NULL" if C is NULL
+char *dumpOf (CMD *c);
+
+
+// Return a script of one line (malloc()-ed): N copies of the stage S joined
+// by OP
+char *chain (const char *s, const char *op, int n);
+
+
+// Parse the script read from IN (which HERE documents are read from too)
+// with HERE documents longer than HEREMAX spilled (see parserSetHereMax()),
+// and pass each tree to CHECK; NAME is the name of the script.  Line numbers
+// count the lines of HERE documents.  Lines with parse errors are skipped.
+void runScript (FILE *in, size_t hereMax, const char *name, TreeCheck *check);
+
+
+// Run the script S (a string) as runScript() does
+void runString (const char *s, size_t hereMax, const char *name,
+                TreeCheck *check);
+
+
+// Run each of the N scripts whose names are in FILE[] as runScript() does;
+// return false (after writing a message to stderr) if one cannot be opened
+bool runFiles (int n, char *file[], size_t hereMax, TreeCheck *check);
+
+
+// Write the summary line of the check PROG to stdout and return its exit
+// status: EXIT_FAILURE if there was any failure
+int report (const char *prog);
+
+#endif
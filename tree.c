@@ -0,0 +1,339 @@
+// tree.c
+//
+// Allocation, freeing, and dumping of command structures (see parsley.h);
+// kept apart from main() in mainParsley.c so that other programs (e.g., the
+// benchmarks in bench/) can link them.
+
+#include "parsley.h"
+#include "stats.h"
+#include "walk.h"
+#include <unistd.h>
+
+
+// Allocate, initialize, and return a pointer to a command structure of type
+// TYPE with left child LEFT and right child RIGHT
+CMD *mallocCMD (int type, CMD *left, CMD *right)
+{
+    CMD *new = malloc(sizeof(*new));
+
+    new->type     = type;
+    new->argc     = 0;
+    new->argv     = malloc (sizeof(char *));
+    new->argv[0]  = NULL;
+    new->nLocal   = 0;
+    new->locVar   = NULL;
+    new->locVal   = NULL;
+    new->fromType = NONE;
+    new->fromFile = NULL;
+    new->fromFd   = -1;
+    new->fromLen  = 0;
+    new->toType   = NONE;
+    new->toFile   = NULL;
+    new->errType  = NONE;
+    new->errFile  = NULL;
+    new->left     = left;
+    new->right    = right;
+    new->arena    = NULL;
+
+    return new;
+}
+
+
+// Free the fields of the command structure *C and C itself, but not its
+// children
+static void freeNode (CMD *c)
+{
+    for (int i = 0; i < c->nLocal; i++) {
+        free (c->locVar[i]);
+        free (c->locVal[i]);
+    }
+    free (c->locVar);
+    free (c->locVal);
+
+    for (char **p = c->argv;  *p;  p++)
+        free (*p);
+    free (c->argv);
+
+    free (c->fromFile);
+    if (c->fromFd >= 0)
+        close (c->fromFd);
+    free (c->toFile);
+    free (c->errFile);
+    free (c);
+}
+
+
+// Free tree of commands rooted at *C and return NULL
+CMD *freeCMD (CMD *c)
+{
+    if (!c)
+        return NULL;
+
+    if (c->arena) {                     // Allocated by parse() from an arena
+        int phase = statsPhase (PHASE_FREE);
+        freeArena (c->arena);           //   so release the whole tree at once
+        statsPhase (phase);
+        return NULL;
+    }
+
+    while (c) {                         // Without recursion or a stack:
+        CMD *next = c->left;            //   rotate any left child up until
+        if (next) {                     //   the root has none, then free the
+            c->left = next->right;      //   root and go on with its right
+            next->right = c;            //   subtree
+        } else {
+            next = c->right;
+            freeNode (c);
+        }
+        c = next;
+    }
+    return NULL;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// Dump CMD structure in tree format
+
+// Print arguments in command data structure rooted at *C to W
+void dumpArgs (Writer *w, CMD *c)
+{
+    if (c->argc < 0)
+        wrLit (w, "  ARGC < 0");
+    else if (c->argv == NULL)
+        wrLit (w, "  ARGV = NULL");
+    else if (c->argv[c->argc] != NULL)
+        wrLit (w, "  ARGV[ARGC] != NULL");
+    else {
+////    fprintf (out, ",  argc = %d", c->argc);
+        for (char **q = c->argv;  *q;  q++) {
+            wrLit (w, ",  argv[");
+            wrLong (w, q-(c->argv));
+            wrLit (w, "] = ");
+            wrStr (w, *q);
+        }
+    }
+}
+
+
+// Print the N chars at S, which are part of a HERE document, to W with each
+// newline shown as a new HERE: line, except a newline that ends the document
+// (as it does if LAST and it is the last of the N chars), which is shown as
+// <newline>
+static void dumpHereText (Writer *w, const char *s, size_t n, bool last)
+{
+    const char *end = s + n;
+
+    for (const char *nl;  (nl = memchr (s, '\n', end - s));  s = nl+1) {
+        wrBytes (w, s, nl - s);
+        if (nl+1 < end || !last)
+            wrLit (w, "\n         HERE:  ");
+        else
+            wrLit (w, "<newline>");
+    }
+    wrBytes (w, s, end - s);
+}
+
+
+// Print the LEN chars of the HERE document in the file FD to W as
+// dumpRedirect() prints fromFile, reading it back a block at a time
+static void dumpHereFd (Writer *w, int fd, size_t len)
+{
+    char buf[64 * 1024];
+    size_t pos = 0;                     // Offset of buf in the file
+
+    wrLit (w, "\n         HERE:  ");
+    while (pos < len) {
+        ssize_t n = pread (fd, buf, sizeof(buf), pos);
+        if (n <= 0)
+            break;
+        pos += n;
+        dumpHereText (w, buf, n, pos >= len);
+    }
+}
+
+
+// Print input/output redirections and local variables in command data
+// structure rooted at *C to W
+void dumpRedirect (Writer *w, CMD *c)
+{
+    if (c->fromType == NONE && c->fromFile == NULL)
+        ;
+    else if (c->fromType == RED_IN && c->fromFile != NULL) {
+        wrLit (w, "  <");
+        wrStr (w, c->fromFile);
+    } else if (c->fromType == RED_IN_HERE && (c->fromFile != NULL
+                                              || c->fromFd >= 0))
+        wrLit (w, "  <<HERE");
+    else
+        wrLit (w, "  ILLEGAL INPUT REDIRECTION");
+
+    if (c->toType == NONE && c->toFile == NULL)
+        ;
+    else if (c->toType == RED_OUT && c->toFile != NULL) {
+        wrLit (w, "  >");
+        wrStr (w, c->toFile);
+    } else if (c->toType == RED_OUT_APP && c->toFile != NULL) {
+        wrLit (w, "  >>");
+        wrStr (w, c->toFile);
+    } else if (c->toType == RED_OUT_ERR && c->toFile != NULL) {
+        wrLit (w, "  &>");
+        wrStr (w, c->toFile);
+    } else
+        wrLit (w, "  ILLEGAL OUTPUT REDIRECTION");
+
+    if (c->errType == NONE && c->errFile == NULL)
+        ;
+    else if (c->errType == RED_ERR && c->errFile != NULL) {
+        wrLit (w, "  2>");
+        wrStr (w, c->errFile);
+    } else if (c->errType == RED_ERR_APP && c->errFile != NULL) {
+        wrLit (w, "  2>>");
+        wrStr (w, c->errFile);
+    } else if (c->errType == RED_OUT_ERR && c->errFile == NULL) {
+        wrLit (w, "  &>");
+        wrStr (w, c->toFile ? c->toFile : "(null)");
+    } else
+        wrLit (w, "  ILLEGAL ERROR REDIRECTION");
+
+    if (c->nLocal < 0) {
+        wrLit (w, "  INVALID NLOCAL");
+    } else if (c->nLocal == 0) {
+        ;
+    } else if (c->locVar == NULL || c->locVal == NULL) {
+        wrLit (w, "  INVALID LOCVAL or LOCVAR");
+    } else {
+        wrLit (w, "\n         LOCAL: ");
+        for (int i = 0; i < c->nLocal; i++) {
+            wrStr (w, c->locVar[i]);
+            if (strchr (c->locVal[i], '='))
+                wrLit (w, " = ");
+            else
+                wrChar (w, '=');
+            wrStr (w, c->locVal[i]);
+            wrLit (w, ", ");
+        }
+    }
+
+    if (c->fromType == RED_IN_HERE) {
+        if (c->fromFile == NULL && c->fromFd >= 0) {
+            dumpHereFd (w, c->fromFd, c->fromLen);
+        } else if (c->fromFile == NULL) {
+            wrLit (w, "  INVALID FROMFILE FOR RED_IN_HERE");
+        } else {
+            wrLit (w, "\n         HERE:  ");
+            dumpHereText (w, c->fromFile, strlen (c->fromFile), true);
+        }
+    }
+}
+
+
+// Print in in-order command data structure rooted at *C at depth LEVEL
+void dumpTree (CMD *c, int level)
+{
+    fdumpTree (stdout, c, level);
+}
+
+
+// Print in in-order command data structure rooted at *C at depth LEVEL to OUT
+void fdumpTree (FILE *out, CMD *c, int level)
+{
+    Writer *w = mallocWriter (-1);              // Format the whole tree, then
+
+    wdumpTree (w, c, level);                    //   hand it to stdio at once
+    fwrite (w->buf, 1, w->len, out);
+    freeWriter (w);
+}
+
+
+// Print the command structure *C (but not its children) to W, without the
+// depth
+void wdumpNode (Writer *w, CMD *c)
+{
+    if (c->type == SIMPLE) {
+        if (c->left != NULL)
+            wrLit (w, "  SIMPLE HAS LEFT CHILD");
+        else if (c->right != NULL)
+            wrLit (w, "  SIMPLE HAS RIGHT CHILD");
+        else {
+            wrLit (w, "SIMPLE");
+            dumpArgs (w, c);
+            dumpRedirect (w, c);
+        }
+
+    } else if (c->argc > 0) {
+        wrLit (w, "  NON-SIMPLE HAS ARGUMENTS");
+
+    } else if (c->type == SUBCMD) {
+        if (c->right != NULL)
+            wrLit (w, "  SUBCMD HAS RIGHT CHILD");
+        else {
+            wrLit (w, "SUBCMD");
+            dumpRedirect (w, c);
+        }
+
+    } else if (c->fromType != NONE
+            || c->fromFile != NULL
+            || c->toType != NONE
+            || c->toFile != NULL
+            || c->errType != NONE
+            || c->errFile != NULL) {
+        wrLit (w, "  NON-SIMPLE, NON-SUBCMD HAS I/O REDIRECTION");
+
+    } else if (c->nLocal > 0) {
+        wrLit (w, "  NON-SIMPLE, NON-SUBCMD HAS LOCAL VARIABLES");
+
+    } else if (c->type == PIPE) {
+        wrLit (w, "PIPE");
+
+    } else if (c->type == SEP_AND) {
+        wrLit (w, "SEP_AND");
+
+    } else if (c->type == SEP_OR) {
+        wrLit (w, "SEP_OR");
+
+    } else if (c->type == SEP_END) {
+        wrLit (w, "SEP_END");
+
+    } else if (c->type == SEP_BG) {
+        wrLit (w, "SEP_BG");
+
+    } else {
+        wrLit (w, "NODE HAS INVALID TYPE");
+    }
+
+    wrChar (w, '\n');
+}
+
+
+// Print the command structure *C (but not its children) at depth LEVEL to W
+static void dumpNode (Writer *w, CMD *c, int level)
+{
+////fprintf (out, "CMD (Level = %d):  ", level);
+    wrLit (w, "CMD (Depth = ");
+    wrLong (w, level);
+    wrLit (w, "):  ");
+    wdumpNode (w, c);
+}
+
+
+// Print in in-order command data structure rooted at *C at depth LEVEL to W;
+// an explicit stack of the nodes whose left subtrees are being printed takes
+// the place of recursion (see walk.h)
+void wdumpTree (Writer *w, CMD *c, int level)
+{
+    Walk stack;
+
+    walkInit (&stack);
+    for ( ; ; ) {
+        for ( ; c; c = c->left)                 // Down to the leftmost node
+            walkPush (&stack, c, level++);
+        if (stack.len == 0)
+            break;
+
+        WalkFrame f = walkPop (&stack);         // Its left subtree is done
+        dumpNode (w, f.cmd, f.n);
+        c = f.cmd->right;
+        level = f.n + 1;
+    }
+    walkFree (&stack);
+}
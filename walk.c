@@ -0,0 +1,41 @@
+// walk.c
+//
+// Explicit stack for walking command trees; see walk.h.
+
+#include "walk.h"
+#include "stats.h"
+
+
+void walkInit (Walk *w)
+{
+    w->frame = w->local;
+    w->len = 0;
+    w->size = WALK_LOCAL;
+}
+
+
+void walkPush (Walk *w, CMD *cmd, int n)
+{
+    if (w->len == w->size) {                    // Full: move to the heap
+        w->size *= 2;
+        if (w->frame == w->local) {
+            w->frame = malloc (w->size * sizeof(*w->frame));
+            memcpy (w->frame, w->local, sizeof(w->local));
+        } else {
+            w->frame = realloc (w->frame, w->size * sizeof(*w->frame));
+        }
+        STATS_ALLOC (w->size * sizeof(*w->frame));
+    }
+    w->frame[w->len].cmd = cmd;
+    w->frame[w->len].n = n;
+    w->frame[w->len].p = NULL;
+    w->len++;
+}
+
+
+void walkFree (Walk *w)
+{
+    if (w->frame != w->local)
+        free (w->frame);
+    walkInit (w);
+}
@@ -0,0 +1,61 @@
+// walk.h
+//
+// Header file for the explicit stack used to walk command trees without
+// recursion.  The trees that parse() makes are left-deep, as deep as the
+// number of stages in a pipeline or of commands in a sequence, so a walk that
+// recursed once per level could overflow the C stack on a long enough line.
+// A Walk keeps its first WALK_LOCAL frames inline (so that walking a typical
+// tree allocates nothing) and the rest in a heap array that doubles when full,
+// so depth is bounded only by memory.
+
+#ifndef WALK_INCLUDED
+#define WALK_INCLUDED           // walk.h has been #include-d
+
+#include "parsley.h"
+
+#define WALK_LOCAL 64                   // #frames kept inline
+
+// A node still to be visited (or being visited) and what the walk keeps with
+// it: a number (e.g., its depth, or how far its visit has got) and a pointer
+// (e.g., to where the result of the visit goes), set through walkTop()
+typedef struct {
+    CMD *cmd;
+    int n;
+    void *p;
+} WalkFrame;
+
+typedef struct walk {
+    WalkFrame *frame;                   // Frames, oldest first
+    size_t len;                         // #frames in use
+    size_t size;                        // #frames allocated
+    WalkFrame local[WALK_LOCAL];        // First frames
+} Walk;
+
+
+// Initialize the empty stack W
+void walkInit (Walk *w);
+
+
+// Push the node CMD with the number N onto W
+void walkPush (Walk *w, CMD *cmd, int n);
+
+
+// Return the frame on top of W, which must not be empty; the pointer is good
+// only until the next walkPush()
+static inline WalkFrame *walkTop (Walk *w)
+{
+    return &w->frame[w->len-1];
+}
+
+
+// Pop the frame on top of W, which must not be empty, and return a copy
+static inline WalkFrame walkPop (Walk *w)
+{
+    return w->frame[--w->len];
+}
+
+
+// Free the storage used by W (but not the nodes)
+void walkFree (Walk *w);
+
+#endif
@@ -0,0 +1,151 @@
+// writer.c
+//
+// Buffered output writer; see writer.h.
+
+#define _GNU_SOURCE                     // For IOV_MAX
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include "writer.h"
+#include "stats.h"
+
+#define WRITER_FLUSH  (64 * 1024)       // #chars buffered for a descriptor
+#define WRITER_MEMORY 4096              // First buffer size in memory
+
+
+Writer *mallocWriter (int fd)
+{
+    Writer *w = malloc (sizeof(*w));
+    if (!w)
+        abort();
+
+    w->fd   = fd;
+    w->len  = 0;
+    w->size = (fd < 0) ? WRITER_MEMORY : WRITER_FLUSH;
+    w->buf  = malloc (w->size);
+    STATS_ALLOC (sizeof(*w) + w->size);
+    if (!w->buf)
+        abort();
+    return w;
+}
+
+
+Writer *freeWriter (Writer *w)
+{
+    if (!w)
+        return NULL;
+
+    flushWriter (w);
+    free (w->buf);
+    free (w);
+    return NULL;
+}
+
+
+bool flushWriter (Writer *w)
+{
+    if (w->fd < 0)
+        return true;
+
+    bool ok = writeAll (w->fd, w->buf, w->len);
+    w->len = 0;
+    return ok;
+}
+
+
+void wrReserve (Writer *w, size_t n)
+{
+    if (w->size - w->len >= n)
+        return;
+
+    if (w->fd >= 0) {                           // Make room by flushing
+        flushWriter (w);
+        if (w->size >= n)
+            return;
+    }
+
+    while (w->size - w->len < n)                // Otherwise grow
+        w->size *= 2;
+    w->buf = realloc (w->buf, w->size);
+    STATS_ALLOC (w->size);
+    if (!w->buf)
+        abort();
+}
+
+
+void wrBytes (Writer *w, const char *s, size_t n)
+{
+    if (w->size - w->len < n) {
+        if (w->fd >= 0 && n >= w->size) {       // Too long to buffer, so
+            flushWriter (w);                    //   write it directly
+            writeAll (w->fd, s, n);
+            return;
+        }
+        wrReserve (w, n);
+    }
+    memcpy (w->buf + w->len, s, n);
+    w->len += n;
+}
+
+
+void wrStr (Writer *w, const char *s)
+{
+    wrBytes (w, s, strlen (s));
+}
+
+
+void wrLong (Writer *w, long n)
+{
+    char digits[24];                            // Enough for any 64-bit long
+    char *d = digits + sizeof(digits);
+    unsigned long u = (n < 0) ? -(unsigned long) n : (unsigned long) n;
+
+    do {                                        // Digits from the right
+        *--d = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    if (n < 0)
+        *--d = '-';
+
+    wrBytes (w, d, digits + sizeof(digits) - d);
+}
+
+
+bool writeAll (int fd, const char *buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t k = write (fd, buf, n);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k <= 0)
+            return false;
+        buf += k;
+        n -= k;
+    }
+    return true;
+}
+
+
+bool writevAll (int fd, struct iovec *iov, int nIov)
+{
+    while (nIov > 0) {
+        ssize_t k = writev (fd, iov, nIov < IOV_MAX ? nIov : IOV_MAX);
+        if (k < 0 && errno == EINTR)
+            continue;
+        if (k < 0)
+            return false;
+
+        while (nIov > 0 && (size_t) k >= iov->iov_len) {   // Skip the buffers
+            k -= iov->iov_len;                              //   written fully
+            iov++;
+            nIov--;
+        }
+        if (nIov > 0) {                                     // Then part of one
+            iov->iov_base = (char *) iov->iov_base + k;
+            iov->iov_len -= k;
+        }
+    }
+    return true;
+}
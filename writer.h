@@ -0,0 +1,76 @@
+// writer.h
+//
+// Header file for the buffered output writer used to dump command trees.
+// Output is formatted into one large buffer, with hand-rolled integer
+// formatting instead of printf(), and the buffer is flushed with a single
+// write() when full (or kept in memory, e.g. for one chunk in batch mode).
+
+#ifndef WRITER_INCLUDED
+#define WRITER_INCLUDED         // writer.h has been #include-d
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+typedef struct writer {
+    char *buf;                          // Output not yet flushed
+    size_t len;                         // #chars in buf
+    size_t size;                        // #chars allocated for buf
+    int fd;                             // Descriptor to flush buf to, or -1
+                                        //   to keep all output in buf
+} Writer;
+
+
+// Allocate, initialize, and return a pointer to a writer that flushes to the
+// descriptor FD, or that keeps all of its output in memory if FD is -1
+Writer *mallocWriter (int fd);
+
+
+// Flush writer W, free it, and return NULL
+Writer *freeWriter (Writer *w);
+
+
+// Write the output buffered in W to its descriptor (if it has one) and empty
+// the buffer; return false on error
+bool flushWriter (Writer *w);
+
+
+// Make room for N more chars in the buffer of W (flushing or growing it)
+void wrReserve (Writer *w, size_t n);
+
+
+// Append the N chars at S to W
+void wrBytes (Writer *w, const char *s, size_t n);
+
+
+// Append the NUL-terminated string S to W
+void wrStr (Writer *w, const char *s);
+
+
+// Append the decimal representation of N to W
+void wrLong (Writer *w, long n);
+
+
+// Append the char C to W
+static inline void wrChar (Writer *w, char c)
+{
+    if (w->len == w->size)
+        wrReserve (w, 1);
+    w->buf[w->len++] = c;
+}
+
+
+// Append the string literal S to W without computing its length at run time
+#define wrLit(w,s) wrBytes (w, s, sizeof(s) - 1)
+
+
+// Write the N chars at BUF to the descriptor FD, retrying after short writes
+// and interrupts; return false on error
+bool writeAll (int fd, const char *buf, size_t n);
+
+
+// Same as writeAll(), but write the NIOV buffers described by IOV (which may
+// be modified) with as few writev() calls as possible
+bool writevAll (int fd, struct iovec *iov, int nIov);
+
+#endif